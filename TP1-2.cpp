@@ -1,26 +1,45 @@
 #include <DGtal/base/Common.h>
 #include <DGtal/helpers/StdDefs.h>
 #include <DGtal/images/ImageSelector.h>
-#include "DGtal/io/readers/PGMReader.h"
 #include "DGtal/io/writers/GenericWriter.h"
 #include <DGtal/images/imagesSetsUtils/SetFromImage.h>
 #include <DGtal/io/boards/Board2D.h>
 #include <DGtal/io/Color.h>
 #include <DGtal/io/colormaps/ColorBrightnessColorMap.h>
-#include <DGtal/topology/SurfelAdjacency.h>
-#include <DGtal/topology/helpers/Surfaces.h>
 #include <DGtal/geometry/curves/GreedySegmentation.h>
 
 #include <iostream>
 #include <vector>
 #include <filesystem>
 #include <string>
-#include <sstream>
 #include <limits>
 #include <algorithm> // For std::
 #include <numeric>
 #include <cmath>
 #include <map> // For std::map
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
+#include <fnmatch.h>
+#include <csignal>
+
+#include "RunLengthLabeling.h"
+#include "PackedFreemanChain.h"
+#include "ContourTracing.h"
+#include "WorkStealingPool.h"
+#include "BoundedQueue.h"
+#include "MappedPGM.h"
+#include "StripLabeling.h"
+#include "GrainMeasurement.h"
+#include "RunningStatistics.h"
+#include "DSSRenderer.h"
+#include "GrainClassifier.h"
+#include "GrainExport.h"
+#include "ResultCache.h"
+#include "DirectoryWatcher.h"
+#include "GrainSeparation.h"
+#include "GrayscaleInput.h"
 
 using namespace std;
 using namespace DGtal;
@@ -28,664 +47,1114 @@ using namespace Z2i;
 
 namespace fs = std::filesystem;
 
-// Define direction mappings for 4-connected Freeman chain codes
-const std::vector<std::pair<int, int>> directionOffsets = {
-    {1, 0},  // 0: East
-    {0, 1},  // 1: North
-    {-1, 0}, // 2: West
-    {0, -1}  // 3: South
-};
+// Function to print the average, median and extremes of one measure
+void printStatistics(const std::string &title, const RunningStatistics &stats)
+{
+    std::cout << "-----------------------------" << std::endl;
+    std::cout << title << std::endl;
+    std::cout << "Average: " << stats.mean() << std::endl;
+    std::cout << "Median: " << stats.median() << std::endl;
+    std::cout << "Minimum: " << stats.min() << std::endl;
+    std::cout << "Maximum: " << stats.max() << std::endl;
+}
 
-// Function to compute the endpoint based on chain code
-std::pair<int, int> computeEndpoint(int startX, int startY, const std::string &chainCode)
+// Function to analyze perimeter distributions across files; foldedFiles holds
+// the perimeters of the files already reported and dropped from the map
+void analyzePerimeterDistributions(const std::map<std::string, RunningStatistics> &perimeters_polygon_by_file,
+                                   const RunningStatistics &foldedFiles)
 {
-    int x = startX;
-    int y = startY;
-    for (char c : chainCode)
-    {
-        if (!isdigit(c))
-            continue; // Ignore non-digit characters
-        int direction = c - '0';
-        if (direction < 0 || direction >= (int)directionOffsets.size())
+    std::cout << "\n=============================" << std::endl;
+    std::cout << "Analyzing perimeter distributions across files:" << std::endl;
+    RunningStatistics allFiles = foldedFiles;
+    for (const auto &entry : perimeters_polygon_by_file)
+    {
+        const std::string &fileName = entry.first;
+        const RunningStatistics &perimeters = entry.second;
+
+        if (!perimeters.empty())
         {
-            // std::cerr << "Invalid direction in chain code: " << direction << std::endl;
-            continue;
+            std::cout << "-----------------------------" << std::endl;
+            std::cout << "File: " << fileName << std::endl;
+            std::cout << "Number of grains: " << perimeters.count() << std::endl;
+            std::cout << "Perimeter statistics (Polygon Perimeter):" << std::endl;
+            std::cout << "Average: " << perimeters.mean() << std::endl;
+            std::cout << "Median: " << perimeters.median() << std::endl;
+            std::cout << "Minimum: " << perimeters.min() << std::endl;
+            std::cout << "Maximum: " << perimeters.max() << std::endl;
+            std::cout << "Standard Deviation: " << perimeters.stddev() << std::endl;
+            allFiles.merge(perimeters);
         }
-        x += directionOffsets[direction].first;
-        y += directionOffsets[direction].second;
+        else
+        {
+            std::cout << "No perimeters found for file: " << fileName << std::endl;
+        }
+    }
+
+    // The per-file digests merge into the distribution of all the grains
+    if (!allFiles.empty())
+    {
+        std::cout << "-----------------------------" << std::endl;
+        std::cout << "All files" << std::endl;
+        std::cout << "Number of grains: " << allFiles.count() << std::endl;
+        std::cout << "Perimeter statistics (Polygon Perimeter):" << std::endl;
+        std::cout << "Average: " << allFiles.mean() << std::endl;
+        std::cout << "Median: " << allFiles.median() << std::endl;
+        std::cout << "Minimum: " << allFiles.min() << std::endl;
+        std::cout << "Maximum: " << allFiles.max() << std::endl;
+        std::cout << "Standard Deviation: " << allFiles.stddev() << std::endl;
     }
-    return {x, y};
+    std::cout << "=============================" << std::endl;
 }
 
-// Function to generate chain code to close the contour (simple approach)
-// Updated to handle diagonal offsets by breaking them into horizontal and vertical steps.
-std::string generateClosureChain(int deltaX, int deltaY)
+// Options of the batch mode
+struct BatchOptions
 {
-    std::string closureChain = "";
+    std::string input = "resources/"; // Directory of *_seg_bin.pgm masks, or a glob such as "scans/*.pgm"
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency()); // Measurement threads
+    unsigned readers = 2;  // Threads reading and decoding images ahead of the measurements
+    size_t inFlight = 4;   // Maximum number of files between reading and reporting
+    bool packed = false;   // Keep masks as 1-bit packed bitmaps instead of mapped bytes
+    int stripHeight = 0;   // Read each mask by strips of this many rows (0: whole image)
+    PerimeterEstimators estimators;
+    std::string render;    // "svg" or "eps": draw the DSS decompositions of all the grains
+    size_t renderSample = 1; // Draw one grain out of renderSample
+    std::string classify;  // "centroid" or "knn": classify the grains (STEP 9)
+    int neighbours = 5;    // k of the kNN classifier
+    std::string train = "resources/"; // Labelled masks, the grain type is taken from the file name
+    std::string exportBinary; // Per-grain columnar binary export
+    std::string exportCsv;    // Per-grain CSV export
+    std::string cache;        // Directory of cached per-grain results (disabled when empty)
+    bool watch = false;       // Keep running and process the masks added to the input directory
+    std::string publish;      // Directory receiving one <mask>.csv per processed file
+    bool separate = false;    // Split touching grains before labeling (STEP 10)
+    double separateDepth = 2.0; // Least dynamic, in pixels, of a distance maximum that starts a grain
+    int threshold = 1;        // Foreground gray levels are (threshold, 255]; 1 for the binary masks
+    bool otsu = false;        // Find the threshold of each image with Otsu's method
+};
 
-    // Handle diagonals by breaking them down into horizontal + vertical moves
-    while (deltaX != 0 && deltaY != 0)
+// Function to read the batch options from the command line:
+//   --input DIR|GLOB   -j|--threads N   --readers N   --in-flight N   --packed
+//   --strip-height N   --estimators cells,polygon,dss   --render svg|eps   --render-sample N
+//   --classify centroid|knn   --k N   --train DIR|GLOB   --export FILE   --export-csv FILE
+//   --cache DIR   --watch   --publish DIR   --separate   --separate-depth H   --threshold otsu|N
+BatchOptions parseOptions(int argc, char **argv)
+{
+    BatchOptions options;
+    for (int i = 1; i < argc; ++i)
     {
-        if (deltaX > 0)
+        std::string arg = argv[i];
+        auto value = [&]()
+        { return i + 1 < argc ? std::string(argv[++i]) : std::string(); };
+        auto count = [&]()
+        { return std::max(1, std::atoi(value().c_str())); };
+
+        if (arg == "--input")
+            options.input = value();
+        else if (arg == "-j" || arg == "--threads")
+            options.threads = static_cast<unsigned>(count());
+        else if (arg == "--readers")
+            options.readers = static_cast<unsigned>(count());
+        else if (arg == "--in-flight")
+            options.inFlight = static_cast<size_t>(count());
+        else if (arg == "--packed")
+            options.packed = true;
+        else if (arg == "--strip-height")
+            options.stripHeight = count();
+        else if (arg == "--estimators")
         {
-            closureChain += "0"; // East
-            deltaX -= 1;
+            const std::string list = "," + value() + ",";
+            options.estimators.cells = list.find(",cells,") != std::string::npos;
+            options.estimators.polygon = list.find(",polygon,") != std::string::npos;
+            options.estimators.dss = list.find(",dss,") != std::string::npos;
         }
-        else if (deltaX < 0)
+        else if (arg == "--render")
+            options.render = value() == "eps" ? "eps" : "svg";
+        else if (arg == "--render-sample")
+            options.renderSample = static_cast<size_t>(count());
+        else if (arg == "--classify")
+            options.classify = value() == "knn" ? "knn" : "centroid";
+        else if (arg == "--k")
+            options.neighbours = count();
+        else if (arg == "--train")
+            options.train = value();
+        else if (arg == "--export")
+            options.exportBinary = value();
+        else if (arg == "--export-csv")
+            options.exportCsv = value();
+        else if (arg == "--cache")
+            options.cache = value();
+        else if (arg == "--watch")
+            options.watch = true;
+        else if (arg == "--publish")
+            options.publish = value();
+        else if (arg == "--separate")
+            options.separate = true;
+        else if (arg == "--separate-depth")
+            options.separateDepth = std::max(0.0, std::atof(value().c_str()));
+        else if (arg == "--threshold")
         {
-            closureChain += "2"; // West
-            deltaX += 1;
+            const std::string threshold = value();
+            options.otsu = threshold == "otsu";
+            if (!options.otsu)
+                options.threshold = std::min(254, std::max(0, std::atoi(threshold.c_str())));
         }
+    }
 
-        if (deltaY > 0)
-        {
-            closureChain += "1"; // North
-            deltaY -= 1;
-        }
-        else if (deltaY < 0)
-        {
-            closureChain += "3"; // South
-            deltaY += 1;
-        }
+    // The classifier uses the DSS perimeter, the most accurate one
+    if (!options.classify.empty())
+        options.estimators.dss = true;
+
+    // The distance transform needs the whole mask
+    if (options.separate && options.stripHeight > 0)
+    {
+        std::cerr << "--separate reads whole masks: --strip-height is ignored" << std::endl;
+        options.stripHeight = 0;
     }
+    return options;
+}
 
-    // Now handle purely horizontal or vertical moves
-    while (deltaX != 0 || deltaY != 0)
+// Function to split the input option into a directory and a file name
+// pattern: a directory means its *_seg_bin.pgm files
+void splitInput(const std::string &input, fs::path &directoryPath, std::string &pattern)
+{
+    const bool isPattern = input.find_first_of("*?[") != std::string::npos;
+    directoryPath = isPattern ? fs::path(input).parent_path() : fs::path(input);
+    if (directoryPath.empty())
+        directoryPath = ".";
+    pattern = isPattern ? fs::path(input).filename().string() : "*_seg_bin.pgm";
+}
+
+// Function to list the input masks: every *_seg_bin.pgm of a directory, or
+// every file matching a glob pattern (wildcards in the file name only)
+std::vector<std::string> listInputFiles(const std::string &input)
+{
+    std::vector<std::string> fileNames;
+    fs::path directoryPath;
+    std::string pattern;
+    splitInput(input, directoryPath, pattern);
+
+    // Iterate over all files in the directory for the pattern specifically
+    for (const auto &entry : fs::directory_iterator(directoryPath))
     {
-        if (deltaX > 0 && deltaY == 0)
-        {
-            closureChain += "0"; // Move East
-            deltaX -= 1;
-        }
-        else if (deltaX < 0 && deltaY == 0)
-        {
-            closureChain += "2"; // Move West
-            deltaX += 1;
-        }
-        else if (deltaY > 0 && deltaX == 0)
-        {
-            closureChain += "1"; // Move North
-            deltaY -= 1;
-        }
-        else if (deltaY < 0 && deltaX == 0)
+        if (entry.is_regular_file() &&
+            fnmatch(pattern.c_str(), entry.path().filename().string().c_str(), 0) == 0)
         {
-            closureChain += "3"; // Move South
-            deltaY += 1;
+            fileNames.push_back(entry.path().string());
         }
-        else
+    }
+    std::sort(fileNames.begin(), fileNames.end());
+    return fileNames;
+}
+
+// Everything the reporting stage needs about one file
+struct FileResult
+{
+    size_t index = 0;
+    std::string fileName;
+    size_t initialComponents = 0;
+    size_t removedComponents = 0;
+    std::vector<TracedContour<Point>> contours;   // Grains not touching the border
+    std::vector<GrainMeasurement> measurements;   // One per contour
+    std::vector<int> classes;                     // Grain type of each contour, when classifying
+    bool fromCache = false;                       // Results read back from the --cache directory
+    std::string error;
+};
+
+// Image handed from the reading stage to the measuring stage
+struct LoadedImage
+{
+    size_t index = 0;
+    std::string fileName;
+    MappedPGM pgm;       // Mapped file, pixels used in place
+    GrayImage decoded;   // Decoded pixels of a PNG file
+    PackedBitmap bitmap; // 1-bit copy of the mask, when reading with --packed
+    unsigned char threshold = 1; // Foreground gray levels are (threshold, 255]
+    bool packed = false;
+    bool streamed = false; // Left on disk, read by strips in the measuring stage
+    bool hasCacheKey = false;
+    uint64_t cacheKey = 0;             // Content key of the mask, with --cache
+    std::unique_ptr<FileResult> cached; // Results found in the cache; nothing to compute
+    std::string error;
+};
+
+// Function to view the pixels of an image read whole, mapped or decoded, with its foreground range
+BinaryMaskView maskOf(const LoadedImage &loaded)
+{
+    if (!loaded.decoded.empty())
+    {
+        const GrayImage &gray = loaded.decoded;
+        return BinaryMaskView{gray.pixels.data(), gray.width, gray.height, static_cast<size_t>(gray.width),
+                              loaded.threshold, 255};
+    }
+    const MappedPGM &pgm = loaded.pgm;
+    return BinaryMaskView{pgm.pixels(), pgm.width(), pgm.height(), pgm.stride(), loaded.threshold, 255};
+}
+
+// Function to finish the content key of a mask: its pixels are already in
+// hasher, add its size and every option that changes the per-grain results
+uint64_t finishCacheKey(ContentHasher &hasher, int width, int height, int threshold, const BatchOptions &options)
+{
+    const std::string parameters = "TP1-2 results v1, DT4_8, foreground (" + std::to_string(threshold) + ", 255], dss " +
+                                   std::to_string(options.estimators.dss ? 1 : 0) + ", separate " +
+                                   (options.separate ? std::to_string(options.separateDepth) : "no");
+    hasher.updateValue(static_cast<int32_t>(width));
+    hasher.updateValue(static_cast<int32_t>(height));
+    hasher.update(parameters.data(), parameters.size());
+    return hasher.digest();
+}
+
+// Function to find the results of a mask in the cache, hashing its pixels in
+// place when it is mapped, or by strips when it stays on disk
+bool lookUpCache(LoadedImage &loaded, const ResultCache &cache, const BatchOptions &options)
+{
+    ContentHasher hasher;
+    if (loaded.streamed)
+    {
+        PGMStripReader reader(loaded.fileName);
+        std::vector<unsigned char> strip;
+        const int rows = std::max(1, (1 << 22) / std::max(1, reader.width()));
+        for (int y0 = 0; y0 < reader.height(); y0 += rows)
         {
-            // For 4-connected, diagonal moves should not occur originally
-            // std::cerr << "Cannot close chain with diagonal moves: deltaX = " << deltaX << ", deltaY = " << deltaY << std::endl;
-            // Previously we had break, but now we handle diagonals above.
-            // No need to break here as diagonals are handled.
+            reader.readRows(y0, std::min(rows, reader.height() - y0), strip);
+            hasher.update(strip.data(), strip.size());
         }
+        loaded.cacheKey = finishCacheKey(hasher, reader.width(), reader.height(), loaded.threshold, options);
     }
+    else
+    {
+        const BinaryMaskView mask = maskOf(loaded);
+        for (int y = 0; y < mask.height; ++y)
+            hasher.update(mask.pixels + static_cast<size_t>(y) * mask.stride, mask.width);
+        loaded.cacheKey = finishCacheKey(hasher, mask.width, mask.height, loaded.threshold, options);
+    }
+    loaded.hasCacheKey = true;
 
-    return closureChain;
+    CachedGrains grains;
+    try
+    {
+        if (!cache.load(loaded.cacheKey, grains))
+            return false;
+    }
+    catch (const std::exception &)
+    {
+        return false; // Damaged entry: compute the results again
+    }
+
+    loaded.cached.reset(new FileResult);
+    loaded.cached->initialComponents = grains.initialComponents;
+    loaded.cached->removedComponents = grains.removedComponents;
+    loaded.cached->contours = std::move(grains.contours);
+    loaded.cached->measurements = std::move(grains.measurements);
+    loaded.cached->fromCache = true;
+    return true;
 }
 
-// Function to compute polygon area using Shoelace formula
-double computePolygonArea(const std::vector<Point> &vertices)
+// Function to read one input file for the measuring stage: map a PGM file, or
+// leave it on disk with --strip-height, or decode a PNG file; then find its
+// threshold, look its results up in the cache, and pack it with --packed
+void loadImage(LoadedImage &loaded, const BatchOptions &options, const ResultCache *cache)
 {
-    if (vertices.size() < 3)
-        return 0.0; // Not a polygon
+    loaded.threshold = static_cast<unsigned char>(options.threshold);
+    const bool png = isPNGFileName(loaded.fileName);
+    if (options.stripHeight > 0 && !png)
+    {
+        loaded.streamed = true;
+        if (options.otsu)
+        {
+            // One more pass over the strips, for the histogram
+            PGMStripReader reader(loaded.fileName);
+            GrayHistogram histogram;
+            std::vector<unsigned char> strip;
+            for (int y0 = 0; y0 < reader.height(); y0 += options.stripHeight)
+            {
+                const int rows = std::min(options.stripHeight, reader.height() - y0);
+                reader.readRows(y0, rows, strip);
+                histogram.addImage(strip.data(), reader.width(), rows, static_cast<size_t>(reader.width()));
+            }
+            loaded.threshold = static_cast<unsigned char>(otsuThreshold(histogram));
+        }
+        if (cache)
+            lookUpCache(loaded, *cache, options);
+        return;
+    }
 
-    double area = 0.0;
-    size_t n = vertices.size();
+    if (png)
+        loaded.decoded = readPNG(loaded.fileName);
+    else
+        loaded.pgm.open(loaded.fileName);
+    if (options.otsu)
+    {
+        const BinaryMaskView mask = maskOf(loaded);
+        GrayHistogram histogram;
+        histogram.addImage(mask.pixels, mask.width, mask.height, mask.stride);
+        loaded.threshold = static_cast<unsigned char>(otsuThreshold(histogram));
+    }
 
-    for (size_t i = 0; i < n; ++i)
+    if (cache && lookUpCache(loaded, *cache, options))
     {
-        const Point &current = vertices[i];
-        const Point &next = vertices[(i + 1) % n];
-        area += (current[0] * next[1]) - (next[0] * current[1]);
+        loaded.pgm.close();
+        loaded.decoded = GrayImage();
+        return;
     }
 
-    return std::abs(area) / 2.0;
+    // With --packed, keep only the 1-bit version and release the pixels right away
+    if (options.packed)
+    {
+        const BinaryMaskView mask = maskOf(loaded);
+        loaded.bitmap = packBitmap(mask.pixels, mask.width, mask.height, mask.stride, mask.minValue, mask.maxValue);
+        loaded.packed = true;
+        loaded.pgm.close();
+        loaded.decoded = GrayImage();
+    }
 }
 
-// Function to compute median of a vector
-double computeMedian(std::vector<double> data)
+// Function to label, trace and measure the grains of an image read by strips
+// of stripHeight rows. Grains are traced and measured as soon as a strip
+// completes them, then sorted back into the raster order of labelRunLength().
+void processImageByStrips(const std::string &fileName, unsigned char threshold, const BatchOptions &options,
+                          WorkStealingPool &pool, FileResult &result)
 {
-    if (data.empty())
-        return 0.0;
+    PGMStripReader reader(fileName);
+    StripLabeler labeler(reader.width(), reader.height());
 
-    std::sort(data.begin(), data.end());
-    size_t n = data.size();
-    if (n % 2 == 0)
+    std::vector<std::pair<int, int>> startPoints; // (y, x) of every component, for the final labels
+    std::vector<TracedContour<Point>> completed;
+    std::vector<GrainRecord> completedRecords;
+    auto onComplete = [&](const GrainRecord &record)
     {
-        return (data[n / 2 - 1] + data[n / 2]) / 2.0;
+        startPoints.emplace_back(record.startY, record.startX);
+        if (record.touchesBorder)
+            return;
+        completed.emplace_back();
+        completed.back().chain = traceOuterChain<Point>(labeler, record.startX, record.startY);
+        completedRecords.push_back(record);
+    };
+
+    // Function to measure the grains completed by the last strip
+    auto measureCompleted = [&]()
+    {
+        const size_t first = result.contours.size();
+        result.measurements.resize(first + completed.size());
+        pool.parallelFor(completed.size(), [&](size_t i, unsigned)
+                         { result.measurements[first + i] = measureGrain(completed[i].chain, completedRecords[i],
+                                                                         options.estimators); });
+        for (TracedContour<Point> &contour : completed)
+            result.contours.push_back(std::move(contour));
+        completed.clear();
+        completedRecords.clear();
+    };
+
+    std::vector<unsigned char> strip;
+    std::vector<uint64_t> bits(labeler.wordsPerRow());
+    for (int y0 = 0; y0 < reader.height(); y0 += options.stripHeight)
+    {
+        const int rows = std::min(options.stripHeight, reader.height() - y0);
+        reader.readRows(y0, rows, strip);
+        for (int r = 0; r < rows; ++r)
+        {
+            std::fill(bits.begin(), bits.end(), 0);
+            packRow(strip.data() + static_cast<size_t>(r) * reader.width(), reader.width(), threshold, 255, bits.data());
+            labeler.pushRow(bits.data(), onComplete);
+        }
+        measureCompleted();
     }
-    else
+    labeler.finish(onComplete);
+    measureCompleted();
+
+    // Back to raster order, with the labels labelRunLength() would give
+    std::sort(startPoints.begin(), startPoints.end());
+    std::vector<size_t> order(result.contours.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const Point &start = result.contours[i].chain.firstPoint();
+        auto rank = std::lower_bound(startPoints.begin(), startPoints.end(), std::make_pair(start[1], start[0]));
+        result.contours[i].label = static_cast<uint32_t>(rank - startPoints.begin() + 1);
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+              { return result.contours[a].label < result.contours[b].label; });
+
+    std::vector<TracedContour<Point>> contours;
+    std::vector<GrainMeasurement> measurements;
+    for (size_t i : order)
     {
-        return data[n / 2];
+        contours.push_back(std::move(result.contours[i]));
+        measurements.push_back(std::move(result.measurements[i]));
     }
+    result.contours = std::move(contours);
+    result.measurements = std::move(measurements);
+    result.initialComponents = startPoints.size();
+    result.removedComponents = startPoints.size() - result.contours.size();
 }
 
-// Function to analyze perimeter distributions across files
-void analyzePerimeterDistributions(const std::map<std::string, std::vector<double>> &perimeters_polygon_by_file)
+// Function to label, trace and measure the grains of one image (STEP 2, 3, 5-7)
+FileResult processImage(LoadedImage &loaded, const BatchOptions &options, WorkStealingPool &pool)
 {
-    std::cout << "\n=============================" << std::endl;
-    std::cout << "Analyzing perimeter distributions across files:" << std::endl;
-    for (const auto &entry : perimeters_polygon_by_file)
+    FileResult result;
+    result.index = loaded.index;
+    result.fileName = loaded.fileName;
+    result.error = loaded.error;
+    if (!result.error.empty())
+        return result;
+
+    if (loaded.cached)
     {
-        const std::string &fileName = entry.first;
-        const std::vector<double> &perimeters = entry.second;
+        result.initialComponents = loaded.cached->initialComponents;
+        result.removedComponents = loaded.cached->removedComponents;
+        result.contours = std::move(loaded.cached->contours);
+        result.measurements = std::move(loaded.cached->measurements);
+        result.fromCache = true;
+        return result;
+    }
 
-        if (!perimeters.empty())
+    if (loaded.streamed)
+    {
+        try
         {
-            double sum = std::accumulate(perimeters.begin(), perimeters.end(), 0.0);
-            double average = sum / perimeters.size();
-            double median = computeMedian(perimeters);
-            double minVal = *std::min_element(perimeters.begin(), perimeters.end());
-            double maxVal = *std::max_element(perimeters.begin(), perimeters.end());
-
-            // Compute standard deviation
-            double variance = 0.0;
-            for (double val : perimeters)
-            {
-                variance += (val - average) * (val - average);
-            }
-            variance /= perimeters.size();
-            double stddev = std::sqrt(variance);
-
-            std::cout << "-----------------------------" << std::endl;
-            std::cout << "File: " << fileName << std::endl;
-            std::cout << "Number of grains: " << perimeters.size() << std::endl;
-            std::cout << "Perimeter statistics (Polygon Perimeter):" << std::endl;
-            std::cout << "Average: " << average << std::endl;
-            std::cout << "Median: " << median << std::endl;
-            std::cout << "Minimum: " << minVal << std::endl;
-            std::cout << "Maximum: " << maxVal << std::endl;
-            std::cout << "Standard Deviation: " << stddev << std::endl;
+            processImageByStrips(loaded.fileName, loaded.threshold, options, pool, result);
+        }
+        catch (const std::exception &e)
+        {
+            result.error = e.what();
         }
+        return result;
+    }
+
+    // 1) Label the foreground in a single run-length pass over the mask, then
+    // 2) trace the outer boundary of every component not touching the border in
+    //    one sweep, straight into packed Freeman chains (pixel corner coordinates).
+    //    Both read either the gray levels in place, thresholded as they go, or
+    //    the packed bitmap.
+    RunLengthLabelMap labelMap;
+    std::vector<TracedContour<Point>> &contours = result.contours;
+    if (options.separate)
+    {
+        // STEP 10: split the touching grains first, into a new packed mask
+        if (loaded.packed)
+            labelMap = labelRunLength(loaded.bitmap.words.data(), loaded.bitmap.width, loaded.bitmap.height,
+                                      loaded.bitmap.wordsPerRow);
         else
         {
-            std::cout << "No perimeters found for file: " << fileName << std::endl;
+            const BinaryMaskView mask = maskOf(loaded);
+            labelMap = labelRunLength(mask.pixels, mask.width, mask.height, mask.stride, mask.minValue, mask.maxValue);
         }
+        const PackedBitmap separated = separateTouchingGrains(labelMap, options.separateDepth, pool);
+        labelMap = labelRunLength(separated.words.data(), separated.width, separated.height, separated.wordsPerRow);
+        contours = traceOuterContours<Point>(separated, labelMap.records);
     }
-    std::cout << "=============================" << std::endl;
+    else if (loaded.packed)
+    {
+        const PackedBitmap &bitmap = loaded.bitmap;
+        labelMap = labelRunLength(bitmap.words.data(), bitmap.width, bitmap.height, bitmap.wordsPerRow);
+        contours = traceOuterContours<Point>(bitmap, labelMap.records);
+    }
+    else
+    {
+        const BinaryMaskView mask = maskOf(loaded); // Masks: 1 is the background, 255 is the object
+        labelMap = labelRunLength(mask.pixels, mask.width, mask.height, mask.stride, mask.minValue, mask.maxValue);
+        contours = traceOuterContours<Point>(mask, labelMap.records);
+    }
+
+    // 3) Boundary check for each component, straight from the per-label records
+    result.initialComponents = labelMap.records.size();
+    for (const GrainRecord &record : labelMap.records)
+    {
+        if (record.touchesBorder)
+            result.removedComponents++;
+    }
+
+    // 4) Measure every grain in parallel; each grain writes its own slot
+    result.measurements.resize(result.contours.size());
+    pool.parallelFor(result.contours.size(), [&](size_t i, unsigned)
+                     { result.measurements[i] = measureGrain(result.contours[i].chain,
+                                                             labelMap.records[result.contours[i].label - 1],
+                                                             options.estimators); });
+    return result;
 }
 
-int main(int argc, char **argv)
+// Function to name an output of a mask, next to it: "scans/a.pgm" and
+// "_greedy-dss-decomposition.svg" give "scans/a_greedy-dss-decomposition.svg"
+std::string outputFileName(const std::string &fileName, const std::string &suffix)
 {
-    setlocale(LC_NUMERIC, "us_US"); // To prevent locale issues
-
-    typedef ImageSelector<Domain, unsigned char>::Type Image;                  // Type of image
-    typedef DigitalSetSelector<Domain, BIG_DS + HIGH_BEL_DS>::Type DigitalSet; // Digital set type
-    typedef Object<DT4_8, DigitalSet> ObjectType;                              // Digital object type
+    const fs::path path(fileName);
+    return (path.parent_path() / (path.stem().string() + suffix)).string();
+}
 
-    std::vector<std::string> fileNames;
-    std::string directoryPath = "resources/";
+// Function to save the greedy DSS decomposition of the first grain of a file (STEP 4)
+void saveFirstGrainDecomposition(const FileResult &result)
+{
+    const std::string &fileName = result.fileName;
+    const Contour4 &theContour = result.contours[0].chain;
 
-    // Map to store perimeters per file
-    std::map<std::string, std::vector<double>> perimeters_polygon_by_file;
+    // ============================
+    // STEP 4: POLYGONIZE DIGITAL OBJECT BOUNDARY
+    // ============================
 
-    // Iterate over all files in the directory for .pgm specifically
-    for (const auto &entry : fs::directory_iterator(directoryPath))
+    if (!theContour.empty())
     {
-        if (entry.is_regular_file())
+        try
         {
-            std::string filePath = entry.path().string();
-            if (filePath.size() >= 12 && filePath.substr(filePath.size() - 12) == "_seg_bin.pgm")
+            // Bounding box of the contour, already found while measuring the grain
+            const ContourMoments &moments = result.measurements[0].moments;
+            const int minX = moments.minX;
+            const int maxX = moments.maxX;
+            const int minY = moments.minY;
+            const int maxY = moments.maxY;
+
+            int padding = 10; // Adjust as needed
+
+            Point p1(minX - padding, minY - padding);
+            Point p2(maxX + padding, maxY + padding);
+            Domain domain(p1, p2);
+
+            Decomposition4 theDecomposition(theContour.begin(), theContour.end(), DSS4());
+
+            Board2D aBoard;
+            aBoard << SetMode(domain.className(), "Grid")
+                   << domain
+                   << SetMode("PointVector", "Grid");
+
+            for (auto itSeg = theDecomposition.begin(); itSeg != theDecomposition.end(); ++itSeg)
             {
-                fileNames.push_back(filePath);
+                aBoard << SetMode("ArithmeticalDSS", "Points")
+                       << itSeg->primitive();
+                aBoard << SetMode("ArithmeticalDSS", "BoundingBox")
+                       << CustomStyle("ArithmeticalDSS/BoundingBox",
+                                      new CustomPenColor(Color::Blue))
+                       << itSeg->primitive();
             }
+
+            std::string svgFileName = outputFileName(fileName, "_greedy-dss-decomposition.svg");
+            aBoard.saveSVG(svgFileName.c_str());
+            std::cout << "Saved greedy DSS decomposition to: " << svgFileName << std::endl;
         }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Polygonization or visualization failed: " << e.what() << std::endl;
+            std::cout << "=============================" << std::endl;
+        }
+    }
+    else
+    {
+        std::cout << "Boundary is empty. Skipping polygonization and visualization." << std::endl;
+        std::cout << "=============================" << std::endl;
     }
+}
 
-    std::cout << "*****************************" << std::endl;
-    std::cout << "Number of files found: " << fileNames.size() << std::endl;
-    std::cout << "*****************************" << std::endl;
+// Function to get the grain type of a labelled mask from its name:
+// "resources/Rice_basmati_seg_bin.pgm" gives "basmati"
+std::string grainTypeOf(const std::string &fileName)
+{
+    std::string type = std::filesystem::path(fileName).stem().string();
+    const size_t suffix = type.find("_seg_bin");
+    if (suffix != std::string::npos)
+        type = type.substr(0, suffix);
+    if (type.compare(0, 5, "Rice_") == 0)
+        type = type.substr(5);
+    return type;
+}
+
+// Function to train the classifier on the grains of the labelled masks (STEP 8)
+void trainClassifier(GrainClassifier &classifier, const BatchOptions &options, WorkStealingPool &pool)
+{
+    GrainFeatureTable table;
+    std::vector<std::string> classNames;
+    for (const std::string &fileName : listInputFiles(options.train))
+    {
+        BatchOptions trainingOptions = options;
+        trainingOptions.stripHeight = 0;
+        LoadedImage loaded;
+        loaded.fileName = fileName;
+        try
+        {
+            loadImage(loaded, trainingOptions, nullptr);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Could not read " << fileName << ": " << e.what() << std::endl;
+            continue;
+        }
+        FileResult result = processImage(loaded, trainingOptions, pool);
+
+        const std::string type = grainTypeOf(fileName);
+        auto found = std::find(classNames.begin(), classNames.end(), type);
+        const int classId = static_cast<int>(found - classNames.begin());
+        if (found == classNames.end())
+            classNames.push_back(type);
+        for (const GrainMeasurement &measurement : result.measurements)
+        {
+            if (measurement.error.empty())
+                table.append(measurement, classId);
+        }
+    }
+    classifier.train(table, classNames);
 
-    for (const auto &fileName : fileNames)
+    std::cout << "Classifier (" << (classifier.method() == GrainClassifier::KNN ? "kNN" : "nearest centroid")
+              << ") trained on " << table.size() << " grains of " << classNames.size() << " types" << std::endl;
+}
+
+// Function to find the type of every grain of a file (-1 when it could not be measured)
+std::vector<int> classifyGrains(const FileResult &result, const GrainClassifier &classifier)
+{
+    GrainFeatureTable table;
+    for (const GrainMeasurement &measurement : result.measurements)
+        table.append(measurement);
+    std::vector<int> classes = classifier.classify(table);
+    for (size_t i = 0; i < classes.size(); ++i)
     {
-        std::cout << "\n"
-                  << std::endl;
-        std::cout << "=============================" << std::endl;
-        std::cout << "Processing file: " << fileName << std::endl;
-        std::cout << "-----------------------------" << std::endl;
+        if (!result.measurements[i].error.empty())
+            classes[i] = -1;
+    }
+    return classes;
+}
 
-        // Read the image from the current filename
-        Image image1 = PGMReader<Image>::importPGM(fileName);
+// Function to print the types found among the grains of a file (STEP 9)
+void reportClassification(const FileResult &result, const GrainClassifier &classifier)
+{
+    std::vector<int> classes;
+    for (int classId : result.classes)
+    {
+        if (classId >= 0)
+            classes.push_back(classId);
+    }
 
-        // 1) Create a "digital set" of the same size as the image
-        DigitalSet aSet(image1.domain()); // A digital set is created with the same domain as the image
+    std::vector<size_t> counts(classifier.classes(), 0);
+    for (int classId : classes)
+        counts[classId]++;
 
-        // 2) Populate the digital set from the image
-        SetFromImage<DigitalSet>::append(aSet, image1, 1, 255); // 1 is the background, 255 is the object
+    std::cout << "-----------------------------" << std::endl;
+    std::cout << "Classification:" << std::endl;
+    for (size_t c = 0; c < counts.size(); ++c)
+        std::cout << classifier.className(static_cast<int>(c)) << ": " << counts[c] << std::endl;
 
-        // 3) Create a digital object from the digital set with (4, 8) adjacency
-        std::vector<ObjectType> objects;                                      // Store all connected components here
-        std::back_insert_iterator<std::vector<ObjectType>> inserter(objects); // Iterator to populate "objects"
-        ObjectType diamond(dt4_8, aSet);
-        unsigned int nbc = diamond.writeComponents(inserter);
+    // Share of the grains given the type of the file, when it is a known one
+    const std::string type = grainTypeOf(result.fileName);
+    for (size_t c = 0; c < counts.size(); ++c)
+    {
+        if (classifier.className(static_cast<int>(c)) == type && !classes.empty())
+            std::cout << "Classified as " << type << ": " << 100.0 * counts[c] / classes.size() << "%" << std::endl;
+    }
+}
 
-        std::cout << "Initial number of connected components: " << objects.size() << std::endl;
+// Function to name the drawing of all the DSS decompositions of a file
+std::string renderFileName(const std::string &fileName, const std::string &format)
+{
+    return outputFileName(fileName, "_dss-decompositions." + format);
+}
 
-        // Variables to track components
-        int boundaryComponents = 0;
-        std::vector<ObjectType> finalComponents;
+// Function to print the report of one file and keep its polygon perimeters
+void reportFile(const FileResult &result, const BatchOptions &options, const GrainClassifier &classifier,
+                std::map<std::string, RunningStatistics> &perimeters_polygon_by_file)
+{
+    const std::string &fileName = result.fileName;
 
-        // Define image bounds for edge checking
-        Point lowerBound = image1.domain().lowerBound();
-        Point upperBound = image1.domain().upperBound();
+    std::cout << "\n"
+              << std::endl;
+    std::cout << "=============================" << std::endl;
+    std::cout << "Processing file: " << fileName << std::endl;
+    std::cout << "-----------------------------" << std::endl;
 
-        // 4) Boundary check for each component
-        for (const auto &component : objects)
-        {
-            bool isBoundary = false;
-            for (const auto &point : component.pointSet())
-            {
-                if (point[0] == lowerBound[0] || point[0] == upperBound[0] ||
-                    point[1] == lowerBound[1] || point[1] == upperBound[1])
-                {
-                    isBoundary = true;
-                    break;
-                }
-            }
+    if (!result.error.empty())
+    {
+        std::cerr << "Could not read " << fileName << ": " << result.error << std::endl;
+        std::cout << "=============================" << std::endl;
+        return;
+    }
 
-            // If not on boundary, add to final list; otherwise, count it as removed
-            if (isBoundary)
-            {
-                boundaryComponents++;
-            }
-            else
-            {
-                finalComponents.push_back(component);
-            }
-        }
+    if (result.fromCache)
+        std::cout << "Results read from the cache" << std::endl;
+    std::cout << "Initial number of connected components: " << result.initialComponents << std::endl;
 
-        // ============================
-        // STEP 2
-        // ============================
+    // ============================
+    // STEP 2
+    // ============================
 
-        // 5) Display the final results for the current file
-        std::cout << "Number of components removed: " << boundaryComponents << std::endl;
-        std::cout << "Final number of connected components: " << finalComponents.size() << std::endl;
-        std::cout << "-----------------------------" << std::endl;
+    std::cout << "Number of components removed: " << result.removedComponents << std::endl;
+    std::cout << "Final number of connected components: " << result.contours.size() << std::endl;
+    std::cout << "-----------------------------" << std::endl;
 
-        // ============================
-        // STEP 3
-        // ============================
+    if (result.contours.empty())
+    {
+        std::cout << "No valid components found. Skipping processing." << std::endl;
+        std::cout << "=============================" << std::endl;
+        return;
+    }
 
-        // 6) Create a Khalimsky space for the entire digital set
-        KSpace kSpace;
-        kSpace.init(aSet.domain().lowerBound() - Point(1, 1),
-                    aSet.domain().upperBound() + Point(1, 1),
-                    true);
+    // Process only the first valid connected component for visualization (Step 4)
+    saveFirstGrainDecomposition(result);
 
-        if (!finalComponents.empty())
-        {
-            // Process only the first valid connected component for visualization (Step 4)
-            const auto &component = finalComponents[0];
+    // All the grains are drawn in the background, once this report is done
+    if (!options.render.empty())
+        std::cout << "Rendering DSS decompositions to: " << renderFileName(fileName, options.render) << std::endl;
 
-            // Extract boundary for the first component
-            SurfelAdjacency<2> adjacency(false); // Use 4-connected adjacency
-            SCell bel = Surfaces<KSpace>::findABel(kSpace, component.pointSet(), 10000);
+    // ============================
+    // STEP 5: CALCULATE AREA AND PERIMETER FOR ALL COMPONENTS
+    // ============================
 
-            if (bel == typename KSpace::SCell())
-            {
-                std::cerr << "Could not find a valid bel for the component!" << std::endl;
-                std::cout << "=============================" << std::endl;
-                continue;
-            }
+    RunningStatistics areas_2cells;
+    RunningStatistics areas_polygon;
+    RunningStatistics perimeters_boundary;
+    RunningStatistics perimeters_polygon;
+    RunningStatistics perimeters_dss;
 
-            std::vector<SCell> boundary;
-            Surfaces<KSpace>::track2DBoundary(boundary, kSpace, adjacency, component.pointSet(), bel);
+    // STEP 7: Circularity
+    // Circularity = (4 * π * Area) / (Perimeter^2)
+    RunningStatistics circularities;
 
-            // ============================
-            // STEP 4: POLYGONIZE DIGITAL OBJECT BOUNDARY
-            // ============================
+    // Gather the results in grain order, so the statistics do not depend on the thread count
+    for (const GrainMeasurement &measurement : result.measurements)
+    {
+        areas_2cells.add(measurement.area_2cells);
+        perimeters_boundary.add(measurement.perimeter_boundary);
 
-            typedef FreemanChain<int> Contour4;
-            typedef ArithmeticalDSSComputer<Contour4::ConstIterator, int, 4> DSS4;
-            typedef GreedySegmentation<DSS4> Decomposition4;
+        if (!measurement.error.empty())
+        {
+            std::cerr << measurement.error << std::endl;
+            continue;
+        }
+        areas_polygon.add(measurement.area_polygon);
+        perimeters_polygon.add(measurement.perimeter_polygon);
+        if (std::isnan(measurement.perimeter_dss))
+            std::cerr << "DSS length estimation failed for a component. Skipping its DSS length." << std::endl;
+        else
+            perimeters_dss.add(measurement.perimeter_dss);
+        circularities.add(measurement.circularity);
+    }
 
-            if (!boundary.empty())
-            {
-                try
-                {
-                    std::stringstream ss;
-                    ss << kSpace.sKCoords(boundary[0])[0] << " " << kSpace.sKCoords(boundary[0])[1] << " "; // Starting point
+    if (!areas_2cells.empty())
+        printStatistics("Area statistics (Number of 2-cells):", areas_2cells);
+    if (!areas_polygon.empty())
+        printStatistics("Area statistics (Polygon Area):", areas_polygon);
+    const PerimeterEstimators &estimators = options.estimators;
+    if (estimators.cells && !perimeters_boundary.empty())
+        printStatistics("Perimeter statistics (Number of 1-cells):", perimeters_boundary);
+    if (estimators.polygon && !perimeters_polygon.empty())
+        printStatistics("Perimeter statistics (Polygon Perimeter):", perimeters_polygon);
+    if (estimators.dss && !perimeters_dss.empty())
+        printStatistics("Perimeter statistics (DSS Length):", perimeters_dss);
+
+    // STEP 7: Print circularity stats
+    if (!circularities.empty())
+        printStatistics("Circularity statistics:", circularities);
+
+    // STEP 9: Classification
+    if (classifier.trained() && !result.classes.empty())
+        reportClassification(result, classifier);
+
+    perimeters_polygon_by_file[fileName] = perimeters_polygon;
+    std::cout << "=============================" << std::endl;
+}
 
-                    for (size_t i = 1; i < boundary.size(); ++i)
-                    {
-                        auto prev = kSpace.sKCoords(boundary[i - 1]);
-                        auto curr = kSpace.sKCoords(boundary[i]);
-
-                        int dx = curr[0] - prev[0];
-                        int dy = curr[1] - prev[1];
-
-                        // Handle valid moves
-                        if (dx == 1 && dy == 0)
-                            ss << "0"; // East
-                        else if (dx == 0 && dy == 1)
-                            ss << "1"; // North
-                        else if (dx == -1 && dy == 0)
-                            ss << "2"; // West
-                        else if (dx == 0 && dy == -1)
-                            ss << "3"; // South
-                        else
-                        {
-                            // Handle invalid moves by breaking them into smaller steps
-                            while (dx != 0 || dy != 0)
-                            {
-                                if (dx > 0)
-                                {
-                                    ss << "0"; // East
-                                    dx -= 1;
-                                }
-                                else if (dx < 0)
-                                {
-                                    ss << "2"; // West
-                                    dx += 1;
-                                }
-                                if (dy > 0)
-                                {
-                                    ss << "1"; // North
-                                    dy -= 1;
-                                }
-                                else if (dy < 0)
-                                {
-                                    ss << "3"; // South
-                                    dy += 1;
-                                }
-                            }
-                        }
-                    }
+// Function to publish the grains of a file as <publish>/<mask>.csv; the file
+// is written under a temporary name and renamed, so it appears complete;
+// false when it could not be
+bool publishFile(const FileResult &result, const std::string &publish)
+{
+    const std::string name = (fs::path(publish) / fs::path(result.fileName).stem()).string() + ".csv";
+    const std::string temporary = name + ".tmp";
+    try
+    {
+        {
+            GrainExporter exporter("", temporary);
+            GrainExportRows rows;
+            rows.fileId = static_cast<uint32_t>(result.index);
+            rows.fileName = result.fileName;
+            rows.contours = &result.contours;
+            rows.measurements = &result.measurements;
+            rows.classes = &result.classes;
+            exporter.write(rows);
+            exporter.close();
+        }
+        fs::rename(temporary, name);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Could not publish " << name << ": " << e.what() << std::endl;
+        std::error_code error;
+        fs::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+// Watch of the input directory in --watch mode, stopped by SIGINT and SIGTERM
+DirectoryWatcher *theWatcher = nullptr;
+
+extern "C" void stopWatching(int)
+{
+    if (theWatcher != nullptr)
+        theWatcher->stop();
+}
+
+int main(int argc, char **argv)
+{
+    setlocale(LC_NUMERIC, "us_US"); // To prevent locale issues
 
-                    auto endpoint = computeEndpoint(kSpace.sKCoords(boundary[0])[0], kSpace.sKCoords(boundary[0])[1], ss.str());
-                    int deltaX = kSpace.sKCoords(boundary[0])[0] - endpoint.first;
-                    int deltaY = kSpace.sKCoords(boundary[0])[1] - endpoint.second;
-                    std::string closureChain = generateClosureChain(deltaX, deltaY);
-                    ss << closureChain;
-                    ss << "\n"; // Ensure the chain ends with a newline
+    const BatchOptions options = parseOptions(argc, argv);
 
-                    Contour4 theContour(ss);
+    // Worker threads for the per-grain measurements, created once for all files
+    WorkStealingPool pool(options.threads);
 
-                    double sumX = 0.0, sumY = 0.0;
-                    int count = 0;
-                    int minX = std::numeric_limits<int>::max();
-                    int maxX = std::numeric_limits<int>::min();
-                    int minY = std::numeric_limits<int>::max();
-                    int maxY = std::numeric_limits<int>::min();
+    // With --watch, the directory is watched before it is listed, so that no
+    // mask added in between is missed
+    std::unique_ptr<DirectoryWatcher> watcher;
+    if (options.watch)
+    {
+        fs::path directoryPath;
+        std::string pattern;
+        splitInput(options.input, directoryPath, pattern);
+        watcher.reset(new DirectoryWatcher(directoryPath.string(), pattern));
+        theWatcher = watcher.get();
+        std::signal(SIGINT, stopWatching);
+        std::signal(SIGTERM, stopWatching);
+    }
 
-                    for (auto it = theContour.begin(); it != theContour.end(); ++it)
-                    {
-                        Point p = *it;
-                        sumX += p[0];
-                        sumY += p[1];
-                        count++;
-
-                        if (p[0] < minX) minX = p[0];
-                        if (p[0] > maxX) maxX = p[0];
-                        if (p[1] < minY) minY = p[1];
-                        if (p[1] > maxY) maxY = p[1];
-                    }
+    std::vector<std::string> fileNames = listInputFiles(options.input);
+    if (watcher)
+    {
+        // A listed file may be reported by the watch too, or still be written:
+        // keep the files the watcher hands over, the others come from next()
+        std::vector<std::string> claimed;
+        for (const std::string &fileName : fileNames)
+        {
+            if (watcher->claimListed(fileName))
+                claimed.push_back(fileName);
+        }
+        fileNames.swap(claimed);
+    }
 
-                    double avgX = sumX / count;
-                    double avgY = sumY / count;
+    // STEP 8: learn the grain types from the labelled masks before anything else
+    GrainClassifier classifier(options.classify == "knn" ? GrainClassifier::KNN : GrainClassifier::NEAREST_CENTROID,
+                               options.neighbours);
+    if (!options.classify.empty())
+        trainClassifier(classifier, options, pool);
 
-                    int width = maxX - minX;
-                    int height = maxY - minY;
+    // Map to store perimeters per file; a watch runs for long, so it only
+    // keeps their merge, each file being printed as it is reported
+    std::map<std::string, RunningStatistics> perimeters_polygon_by_file;
+    RunningStatistics watchedFiles;
 
-                    int padding = 10; // Adjust as needed
+    std::cout << "*****************************" << std::endl;
+    std::cout << "Number of files found: " << fileNames.size() << std::endl;
+    if (watcher)
+        std::cout << "Watching " << options.input << " for new masks (stop with Ctrl-C)" << std::endl;
+    std::cout << "*****************************" << std::endl;
 
-                    Point p1(minX - padding, minY - padding);
-                    Point p2(maxX + padding, maxY + padding);
-                    Domain domain(p1, p2);
+    // Bounded pipeline: readers -> measuring thread -> reporting (this thread).
+    // A file takes one of `inFlight` tokens before it is read and gives it back
+    // once reported, which bounds the memory held by the pipeline.
+    BoundedQueue<int> tokens(options.inFlight);
+    for (size_t i = 0; i < options.inFlight; ++i)
+        tokens.push(0);
+    BoundedQueue<LoadedImage> loadedImages(options.inFlight);
+    BoundedQueue<FileResult> results(options.inFlight);
 
-                    Decomposition4 theDecomposition(theContour.begin(), theContour.end(), DSS4());
+    if (!options.publish.empty())
+    {
+        std::error_code error;
+        fs::create_directories(options.publish, error);
+    }
 
-                    Board2D aBoard;
-                    aBoard << SetMode(domain.className(), "Grid")
-                           << domain
-                           << SetMode("PointVector", "Grid");
+    // Results of unchanged masks, from earlier runs
+    std::unique_ptr<ResultCache> cache;
+    if (!options.cache.empty())
+    {
+        std::error_code error;
+        fs::create_directories(options.cache, error);
+        cache.reset(new ResultCache(options.cache));
+    }
 
-                    for (auto itSeg = theDecomposition.begin(); itSeg != theDecomposition.end(); ++itSeg)
+    size_t nextFile = 0;
+    std::mutex claimMutex;
+    std::vector<std::thread> readers;
+    std::atomic<unsigned> activeReaders{options.readers};
+    for (unsigned r = 0; r < options.readers; ++r)
+    {
+        readers.emplace_back([&]()
+        {
+            for (;;)
+            {
+                // Files are claimed in order, after their token, so the next
+                // file to report is always already being read. Once the listed
+                // files are claimed, --watch waits for the next one to arrive.
+                LoadedImage loaded;
+                {
+                    std::lock_guard<std::mutex> guard(claimMutex);
+                    if (!watcher && nextFile >= fileNames.size())
+                        break;
+                    int token;
+                    if (!tokens.pop(token))
+                        break;
+                    if (nextFile < fileNames.size())
+                        loaded.fileName = fileNames[nextFile];
+                    else if (!watcher->next(loaded.fileName))
                     {
-                        aBoard << SetMode("ArithmeticalDSS", "Points")
-                               << itSeg->primitive();
-                        aBoard << SetMode("ArithmeticalDSS", "BoundingBox")
-                               << CustomStyle("ArithmeticalDSS/BoundingBox",
-                                              new CustomPenColor(Color::Blue))
-                               << itSeg->primitive();
+                        tokens.push(0);
+                        break;
                     }
+                    loaded.index = nextFile++;
+                }
 
-                    std::string svgFileName = std::filesystem::path(fileName).stem().string() + "_greedy-dss-decomposition.svg";
-                    aBoard.saveSVG(("resources/" + svgFileName).c_str());
-                    std::cout << "Saved greedy DSS decomposition to: " << svgFileName << std::endl;
+                try
+                {
+                    loadImage(loaded, options, cache.get());
                 }
                 catch (const std::exception &e)
                 {
-                    std::cerr << "Polygonization or visualization failed: " << e.what() << std::endl;
-                    std::cout << "=============================" << std::endl;
+                    loaded.error = e.what();
                 }
+                loadedImages.push(std::move(loaded));
             }
-            else
+            if (--activeReaders == 0)
+                loadedImages.close();
+        });
+    }
+
+    std::thread measurer([&]()
+    {
+        LoadedImage loaded;
+        while (loadedImages.pop(loaded))
+        {
+            FileResult result = processImage(loaded, options, pool);
+            if (cache && loaded.hasCacheKey && !result.fromCache && result.error.empty())
             {
-                std::cout << "Boundary is empty. Skipping polygonization and visualization." << std::endl;
-                std::cout << "=============================" << std::endl;
+                CachedGrains grains;
+                grains.initialComponents = result.initialComponents;
+                grains.removedComponents = result.removedComponents;
+                grains.contours = result.contours;
+                grains.measurements = result.measurements;
+                cache->store(loaded.cacheKey, grains);
             }
+            results.push(std::move(result));
+            loaded = LoadedImage();
+        }
+        results.close();
+    });
 
-            // ============================
-            // STEP 5: CALCULATE AREA AND PERIMETER FOR ALL COMPONENTS
-            // ============================
-
-            std::vector<double> areas_2cells;
-            std::vector<double> areas_polygon;
-            std::vector<double> perimeters_boundary;
-            std::vector<double> perimeters_polygon;
+    // Per-grain export, written file by file as they are reported
+    std::unique_ptr<GrainExporter> exporter;
+    if (!options.exportBinary.empty() || !options.exportCsv.empty())
+    {
+        try
+        {
+            exporter.reset(new GrainExporter(options.exportBinary, options.exportCsv));
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Export disabled: " << e.what() << std::endl;
+        }
+    }
 
-            // STEP 7: Circularity
-            // Circularity = (4 * π * Area) / (Perimeter^2)
-            std::vector<double> circularities;
+    // Drawing of all the grains, on its own thread, off the measuring path
+    std::unique_ptr<DSSRenderer> renderer;
+    if (!options.render.empty())
+    {
+        renderer.reset(new DSSRenderer(options.render == "eps" ? DSSRenderer::EPS : DSSRenderer::SVG,
+                                       options.renderSample, options.inFlight));
+    }
 
-            for (const auto &comp : finalComponents)
+    // Report the files in their listing (or arrival) order, whatever order they finish in
+    std::map<size_t, FileResult> pending;
+    size_t nextToReport = 0;
+    size_t failedFiles = 0; // Files not read, exported or published
+    bool exportIncomplete = false;
+    FileResult result;
+    while (results.pop(result))
+    {
+        pending.emplace(result.index, std::move(result));
+        for (auto it = pending.find(nextToReport); it != pending.end(); it = pending.find(nextToReport))
+        {
+            if (classifier.trained())
+                it->second.classes = classifyGrains(it->second, classifier);
+            reportFile(it->second, options, classifier, perimeters_polygon_by_file);
+            bool failed = !it->second.error.empty();
+            if (exporter && it->second.error.empty())
             {
-                double area_2cells = static_cast<double>(comp.pointSet().size());
-                areas_2cells.push_back(area_2cells);
-
-                SurfelAdjacency<2> adjacency(false); // 4-connected
-                SCell bel = Surfaces<KSpace>::findABel(kSpace, comp.pointSet(), 10000);
-
-                if (bel == typename KSpace::SCell())
+                GrainExportRows rows;
+                rows.fileId = static_cast<uint32_t>(it->second.index);
+                rows.fileName = it->second.fileName;
+                rows.contours = &it->second.contours;
+                rows.measurements = &it->second.measurements;
+                rows.classes = &it->second.classes;
+                try
                 {
-                    std::cerr << "Could not find a valid bel for a component!" << std::endl;
-                    continue;
+                    exporter->write(rows);
                 }
-
-                std::vector<SCell> boundary_comp;
-                Surfaces<KSpace>::track2DBoundary(boundary_comp, kSpace, adjacency, comp.pointSet(), bel);
-
-                double perimeter_boundary_val = static_cast<double>(boundary_comp.size());
-                perimeters_boundary.push_back(perimeter_boundary_val);
-
-                if (!boundary_comp.empty())
+                catch (const std::exception &e)
                 {
-                    try
+                    // A full disk stops the export, not the pipeline; the
+                    // export keeps the files written before
+                    failed = true;
+                    if (exporter->isOpen())
                     {
-                        std::stringstream ss;
-                        ss << kSpace.sKCoords(boundary_comp[0])[0] << " " << kSpace.sKCoords(boundary_comp[0])[1] << " "; // start
-
-                        for (size_t i = 1; i < boundary_comp.size(); ++i)
-                        {
-                            auto prev = kSpace.sKCoords(boundary_comp[i - 1]);
-                            auto curr = kSpace.sKCoords(boundary_comp[i]);
-
-                            int dx = curr[0] - prev[0];
-                            int dy = curr[1] - prev[1];
-
-                            if (dx == 1 && dy == 0) ss << "0";
-                            else if (dx == 0 && dy == 1) ss << "1";
-                            else if (dx == -1 && dy == 0) ss << "2";
-                            else if (dx == 0 && dy == -1) ss << "3";
-                            else
-                            {
-                                while (dx != 0 || dy != 0)
-                                {
-                                    if (dx > 0) { ss << "0"; dx -= 1; }
-                                    else if (dx < 0) { ss << "2"; dx += 1; }
-                                    if (dy > 0) { ss << "1"; dy -= 1; }
-                                    else if (dy < 0) { ss << "3"; dy += 1; }
-                                }
-                            }
-                        }
-
-                        auto endpoint = computeEndpoint(kSpace.sKCoords(boundary_comp[0])[0], kSpace.sKCoords(boundary_comp[0])[1], ss.str());
-                        int deltaX = kSpace.sKCoords(boundary_comp[0])[0] - endpoint.first;
-                        int deltaY = kSpace.sKCoords(boundary_comp[0])[1] - endpoint.second;
-                        std::string closureChain = generateClosureChain(deltaX, deltaY);
-                        ss << closureChain;
-                        ss << "\n";
-
-                        typedef FreemanChain<int> Contour4;
-                        Contour4 theContour(ss);
-
-                        std::vector<Point> polygonVertices;
-                        for (auto it = theContour.begin(); it != theContour.end(); ++it)
-                        {
-                            polygonVertices.push_back(*it);
-                        }
-
-                        double area_polygon_val = computePolygonArea(polygonVertices);
-                        areas_polygon.push_back(area_polygon_val);
-
-                        double perimeter_polygon_val = 0.0;
-                        size_t numVertices = polygonVertices.size();
-                        for (size_t i = 0; i < numVertices; ++i)
-                        {
-                            const Point &current = polygonVertices[i];
-                            const Point &next = polygonVertices[(i + 1) % numVertices];
-                            double dx = next[0] - current[0];
-                            double dy = next[1] - current[1];
-                            perimeter_polygon_val += std::sqrt(dx * dx + dy * dy);
-                        }
-                        perimeters_polygon.push_back(perimeter_polygon_val);
-
-                        // STEP 7: Calculate circularity
-                        // Circularity = (4 * π * Area) / (Perimeter^2)
-                        double circularity = 0.0;
-                        if (perimeter_polygon_val > 0.0)
-                        {
-                            circularity = (4.0 * M_PI * area_polygon_val) / (perimeter_polygon_val * perimeter_polygon_val);
-                        }
-                        circularities.push_back(circularity);
-
+                        std::cerr << "Not exported: " << e.what() << std::endl;
                     }
-                    catch (const std::exception &e)
+                    else
                     {
-                        std::cerr << "Area or perimeter calculation failed for a component: " << e.what() << std::endl;
-                        continue;
+                        std::cerr << "Export disabled: " << e.what() << std::endl;
+                        exporter.reset();
+                        exportIncomplete = true;
                     }
                 }
-                else
-                {
-                    std::cerr << "Boundary is empty for a component. Skipping area and perimeter calculation." << std::endl;
-                    continue;
-                }
             }
-
-            // Compute statistics for areas_2cells
-            if (!areas_2cells.empty())
+            if (!options.publish.empty() && it->second.error.empty() && !publishFile(it->second, options.publish))
+                failed = true;
+            if (failed)
+                ++failedFiles;
+            if (renderer && it->second.error.empty() && !it->second.contours.empty())
             {
-                double sum_2cells = std::accumulate(areas_2cells.begin(), areas_2cells.end(), 0.0);
-                double avg_2cells = sum_2cells / areas_2cells.size();
-                double median_2cells = computeMedian(areas_2cells);
-                double min_2cells = *std::min_element(areas_2cells.begin(), areas_2cells.end());
-                double max_2cells = *std::max_element(areas_2cells.begin(), areas_2cells.end());
-
-                std::cout << "-----------------------------" << std::endl;
-                std::cout << "Area statistics (Number of 2-cells):" << std::endl;
-                std::cout << "Average: " << avg_2cells << std::endl;
-                std::cout << "Median: " << median_2cells << std::endl;
-                std::cout << "Minimum: " << min_2cells << std::endl;
-                std::cout << "Maximum: " << max_2cells << std::endl;
+                RenderJob job;
+                job.outputName = renderFileName(it->second.fileName, options.render);
+                job.contours = std::move(it->second.contours);
+                job.measurements = std::move(it->second.measurements);
+                renderer->submit(std::move(job));
             }
-
-            // Compute statistics for areas_polygon
-            if (!areas_polygon.empty())
+            if (watcher)
             {
-                double sum_polygon = std::accumulate(areas_polygon.begin(), areas_polygon.end(), 0.0);
-                double avg_polygon = sum_polygon / areas_polygon.size();
-                double median_polygon = computeMedian(areas_polygon);
-                double min_polygon = *std::min_element(areas_polygon.begin(), areas_polygon.end());
-                double max_polygon = *std::max_element(areas_polygon.begin(), areas_polygon.end());
-
-                std::cout << "-----------------------------" << std::endl;
-                std::cout << "Area statistics (Polygon Area):" << std::endl;
-                std::cout << "Average: " << avg_polygon << std::endl;
-                std::cout << "Median: " << median_polygon << std::endl;
-                std::cout << "Minimum: " << min_polygon << std::endl;
-                std::cout << "Maximum: " << max_polygon << std::endl;
-            }
-
-            // Compute statistics for perimeters_boundary
-            if (!perimeters_boundary.empty())
-            {
-                double sum_perimeter_boundary = std::accumulate(perimeters_boundary.begin(), perimeters_boundary.end(), 0.0);
-                double avg_perimeter_boundary = sum_perimeter_boundary / perimeters_boundary.size();
-                double median_perimeter_boundary = computeMedian(perimeters_boundary);
-                double min_perimeter_boundary = *std::min_element(perimeters_boundary.begin(), perimeters_boundary.end());
-                double max_perimeter_boundary = *std::max_element(perimeters_boundary.begin(), perimeters_boundary.end());
-
-                std::cout << "-----------------------------" << std::endl;
-                std::cout << "Perimeter statistics (Number of 1-cells):" << std::endl;
-                std::cout << "Average: " << avg_perimeter_boundary << std::endl;
-                std::cout << "Median: " << median_perimeter_boundary << std::endl;
-                std::cout << "Minimum: " << min_perimeter_boundary << std::endl;
-                std::cout << "Maximum: " << max_perimeter_boundary << std::endl;
-            }
-
-            // Compute statistics for perimeters_polygon
-            if (!perimeters_polygon.empty())
-            {
-                double sum_perimeter_polygon = std::accumulate(perimeters_polygon.begin(), perimeters_polygon.end(), 0.0);
-                double avg_perimeter_polygon = sum_perimeter_polygon / perimeters_polygon.size();
-                double median_perimeter_polygon = computeMedian(perimeters_polygon);
-                double min_perimeter_polygon = *std::min_element(perimeters_polygon.begin(), perimeters_polygon.end());
-                double max_perimeter_polygon = *std::max_element(perimeters_polygon.begin(), perimeters_polygon.end());
-
-                std::cout << "-----------------------------" << std::endl;
-                std::cout << "Perimeter statistics (Polygon Perimeter):" << std::endl;
-                std::cout << "Average: " << avg_perimeter_polygon << std::endl;
-                std::cout << "Median: " << median_perimeter_polygon << std::endl;
-                std::cout << "Minimum: " << min_perimeter_polygon << std::endl;
-                std::cout << "Maximum: " << max_perimeter_polygon << std::endl;
-            }
-
-            // STEP 7: Print circularity stats
-            if (!circularities.empty())
-            {
-                double sum_circ = std::accumulate(circularities.begin(), circularities.end(), 0.0);
-                double avg_circ = sum_circ / circularities.size();
-                double median_circ = computeMedian(circularities);
-                double min_circ = *std::min_element(circularities.begin(), circularities.end());
-                double max_circ = *std::max_element(circularities.begin(), circularities.end());
-
-                std::cout << "-----------------------------" << std::endl;
-                std::cout << "Circularity statistics:" << std::endl;
-                std::cout << "Average: " << avg_circ << std::endl;
-                std::cout << "Median: " << median_circ << std::endl;
-                std::cout << "Minimum: " << min_circ << std::endl;
-                std::cout << "Maximum: " << max_circ << std::endl;
+                auto found = perimeters_polygon_by_file.find(it->second.fileName);
+                if (found != perimeters_polygon_by_file.end())
+                {
+                    watchedFiles.merge(found->second);
+                    perimeters_polygon_by_file.erase(found);
+                }
+                watcher->forget(it->second.fileName);
             }
+            pending.erase(it);
+            ++nextToReport;
+            tokens.push(0);
+        }
+    }
 
-            perimeters_polygon_by_file[fileName] = perimeters_polygon;
-
-            std::cout << "=============================" << std::endl;
+    tokens.close();
+    for (std::thread &reader : readers)
+        reader.join();
+    measurer.join();
+    if (renderer)
+        renderer->finish();
+    if (exporter)
+    {
+        try
+        {
+            exporter->close();
         }
-        else
+        catch (const std::exception &e)
         {
-            std::cout << "No valid components found. Skipping processing." << std::endl;
-            std::cout << "=============================" << std::endl;
+            std::cerr << "Export incomplete: " << e.what() << std::endl;
+            exportIncomplete = true;
         }
     }
 
-    analyzePerimeterDistributions(perimeters_polygon_by_file);
+    analyzePerimeterDistributions(perimeters_polygon_by_file, watchedFiles);
 
     std::cout << "\n"
               << std::endl;
+    if (failedFiles > 0 || exportIncomplete)
+    {
+        std::cout << "Files that failed: " << failedFiles << " out of " << nextToReport << std::endl;
+        if (exportIncomplete)
+            std::cout << "The export is incomplete." << std::endl;
+        return 1;
+    }
     std::cout << "All files processed successfully." << std::endl;
     return 0;
-}
\ No newline at end of file
+}
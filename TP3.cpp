@@ -1,91 +1,239 @@
+// The analysis only needs the headers of include/; DGtal is used by the 3D
+// viewer alone, so a build without it (TP3_VIEWER=OFF) needs no DGtal at all
+#if defined(WITH_VIEWER)
 #include <DGtal/base/Common.h>
 #include <DGtal/helpers/StdDefs.h>
-#include <DGtal/images/ImageSelector.h>
-#include <DGtal/io/readers/GenericReader.h>
-#include <DGtal/io/writers/GenericWriter.h>
 #include <DGtal/io/viewers/Viewer3D.h>
-#include <DGtal/images/imagesSetsUtils/SetFromImage.h>
-#include <DGtal/topology/CubicalComplex.h>
+#endif
 
+#include <algorithm>
+#include <chrono>
+#include <clocale>
+#include <cstdlib>
 #include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fnmatch.h>
+
+#include "BitVolume.h"
+#include "DenseCubicalComplex.h"
+#include "EulerCharacteristic.h"
+#include "VolumeFile.h"
+#include "VolumeLabeling.h"
 
 
 using namespace std;
+#if defined(WITH_VIEWER)
 using namespace DGtal;
 using namespace Z3i;
+#endif
+namespace fs = std::filesystem;
 
-int main(int argc, char** argv)
+// Options of TP3
+struct TopologyOptions
 {
-    setlocale(LC_NUMERIC, "us_US"); //To prevent French local settings
-    typedef ImageSelector<Z3i::Domain, int>::Type Image3D;
-    typedef Object<DT26_6, DigitalSet> ObjectType26_6;
-    typedef Object<DT6_26, DigitalSet> ObjectType6_26;
-    typedef map<Cell, CubicalCellData>   Map;
-    typedef CubicalComplex< KSpace, Map > CC; 
-    
-    std::cout << "Current working directory: " << std::filesystem::current_path() << std::endl;
-
-    // read a 3D image
-    Image3D image = VolReader<Image3D>::importVol("3D/fertility-64.vol");
-
-    std::cout << "Lower Bound: " << image.domain().lowerBound() << std::endl;
-    std::cout << "Upper Bound: " << image.domain().upperBound() << std::endl;
-
-
-    // make the foreground and background digital sets from the image
-    Z3i::DigitalSet set_foreground ( image.domain() );                                 // Create a digital set of proper size
-    Z3i::DigitalSet set_background ( image.domain() );
-    SetFromImage<Z3i::DigitalSet>::append<Image3D>(set_foreground, image, 0, 255);     //populate a digital set from the input image
-    SetFromImage<Z3i::DigitalSet>::append<Image3D>(set_background, image, -1, 1);
-
-    // add your codes here.
-    ObjectType26_6 object_foreground(dt26_6, set_foreground);
-    ObjectType6_26 object_background(dt6_26, set_background);
-    
-    /*std::vector< ObjectType26_6 > objects26_6;
-    std::back_insert_iterator< std::vector< ObjectType26_6 > > inserter26_6( objects26_6 );
-
-    std::vector< ObjectType6_26 > objects6_26;
-    std::back_insert_iterator< std::vector< ObjectType6_26 > > inserter6_26( objects6_26 );
-
-    unsigned int nbc26_6 = object_foreground.writeComponents( inserter26_6 );
-    std::cout << " number of components foreground : " << objects26_6.size() << endl; // Right now size of "objects" is the number of conected components
-
-    /*unsigned int nbc6_26 = object_background.writeComponents( inserter6_26 );
-    std::cout << " number of components background : " << objects26_6.size() << endl; // Right now size of "objects" is the number of conected components*/
-
-    KSpace K;
-    K.init (  set_foreground.domain().lowerBound(), set_foreground.domain().upperBound(), true );
-    CC complex ( K );
-    complex.construct(set_foreground);
-    cout << "0-cells : " << complex.getCells(0).size() << endl;
-    cout << "1-cells : " << complex.getCells(1).size() << endl;
-    cout << "2-cells : " << complex.getCells(2).size() << endl;
-    cout << "3-cells : " << complex.getCells(3).size() << endl;
-    int euler = complex.getCells(0).size() - complex.getCells(1).size() + complex.getCells(2).size() - complex.getCells(3).size();
-    cout << "euler : " << euler << endl;
-
-    // Step 4: Calculate the number of tunnels
-
-    // Foreground connected components (C) with 26-connectivity
-    std::vector<ObjectType26_6> components_foreground;
-    std::back_insert_iterator<std::vector<ObjectType26_6>> inserter_foreground(components_foreground);
-    unsigned int C = object_foreground.writeComponents(inserter_foreground);
-    std::cout << "Number of connected components in foreground (C): " << C << std::endl;
-
-    // Background connected components (H) with 26-connectivity
-    std::vector<ObjectType6_26> components_background;
-    std::back_insert_iterator<std::vector<ObjectType6_26>> inserter_background(components_background);
-    unsigned int H = object_background.writeComponents(inserter_background);
-    std::cout << "Number of cavities in background (H): " << H << std::endl;
-
-    // Euler characteristic (already calculated)
-    int euler_characteristic = euler; // From Step 3
-    std::cout << "Euler characteristic (χ): " << euler_characteristic << std::endl;
-
-    // Calculate the number of tunnels (T)
-    int T = C + H - euler_characteristic;
-    std::cout << "Number of tunnels (T): " << T << std::endl;
+    std::vector<std::string> inputs;  // .vol files, directories of .vol files or globs such as "scans/*.vol"
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string output;               // CSV file of the results, one line per volume (none when empty)
+    bool collapse = false;            // Check T on the collapsed cubical complex
+    bool view = false;                // Show the first volume in the 3D viewer once done
+};
+
+// Function to read the options from the command line:
+//   [--input] FILE|DIR|GLOB ...   -j|--threads N   --output FILE   --collapse   --view
+TopologyOptions parseOptions(int argc, char **argv)
+{
+    TopologyOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]()
+        { return i + 1 < argc ? std::string(argv[++i]) : std::string(); };
+
+        if (arg == "--input")
+            options.inputs.push_back(value());
+        else if (arg == "-j" || arg == "--threads")
+            options.threads = static_cast<unsigned>(std::max(1, std::atoi(value().c_str())));
+        else if (arg == "--output")
+            options.output = value();
+        else if (arg == "--collapse")
+            options.collapse = true;
+        else if (arg == "--view")
+            options.view = true;
+        else
+            options.inputs.push_back(arg);
+    }
+    if (options.inputs.empty())
+        options.inputs.push_back("3D/fertility-64.vol");
+    return options;
+}
+
+// Function to list the volumes of the inputs: a file as is, every *.vol of a
+// directory, or every file matching a glob pattern (wildcards in the file name only)
+std::vector<std::string> listVolumeFiles(const std::vector<std::string> &inputs)
+{
+    std::vector<std::string> fileNames;
+    for (const std::string &input : inputs)
+    {
+        const bool isPattern = input.find_first_of("*?[") != std::string::npos;
+        if (!isPattern && !fs::is_directory(input))
+        {
+            fileNames.push_back(input);
+            continue;
+        }
+
+        fs::path directoryPath = isPattern ? fs::path(input).parent_path() : fs::path(input);
+        if (directoryPath.empty())
+            directoryPath = ".";
+        const std::string pattern = isPattern ? fs::path(input).filename().string() : "*.vol";
+        std::vector<std::string> matches;
+        for (const auto &entry : fs::directory_iterator(directoryPath))
+        {
+            if (entry.is_regular_file() &&
+                fnmatch(pattern.c_str(), entry.path().filename().string().c_str(), 0) == 0)
+            {
+                matches.push_back(entry.path().string());
+            }
+        }
+        std::sort(matches.begin(), matches.end());
+        fileNames.insert(fileNames.end(), matches.begin(), matches.end());
+    }
+    return fileNames;
+}
+
+// Topology of one volume
+struct VolumeResult
+{
+    std::string fileName;
+    int width = 0, height = 0, depth = 0;
+    size_t voxels = 0;
+    size_t C = 0;             // Components of the foreground, 26-adjacency
+    size_t H = 0;             // Components of the background, 6-adjacency, the outside included
+    long long euler = 0;      // Euler characteristic, 26/6
+    long long euler6_26 = 0;  // Euler characteristic, 6/26
+    long long T = 0;          // Tunnels
+    size_t cells[4] = {0, 0, 0, 0}; // Cells of the cubical complex, with --collapse
+    long long cycles = -1;    // Independent cycles of the collapsed complex, -1 when not a graph or not collapsed
+    double milliseconds = 0.0;
+    std::string error;
+};
+
+// Function to compute C, H, χ and T of a volume, and to collapse its complex with --collapse
+VolumeResult analyzeVolume(const std::string &fileName, const TopologyOptions &options, WorkStealingPool &pool)
+{
+    VolumeResult result;
+    result.fileName = fileName;
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        // read the 3D image, streamed straight into a bit-packed volume (1 bit per voxel)
+        BitVolume volume = readVolumeFile(fileName);
+        result.width = volume.width();
+        result.height = volume.height();
+        result.depth = volume.depth();
+        result.voxels = volume.count();
+
+        // Euler characteristic from the 2x2x2 configurations of voxels, in one pass and without any cell
+        result.euler = eulerCharacteristic(volume, TOPOLOGY_26_6);
+        result.euler6_26 = eulerCharacteristic(volume, TOPOLOGY_6_26);
+
+        // Components of the foreground (C) and of the background (H), labeled block by block
+        result.C = countVolumeComponents(volume, true, ADJACENCY_26, pool);
+        result.H = countVolumeComponents(volume, false, ADJACENCY_6, pool);
+
+        // Number of tunnels (T); one of the H background components is the outside
+        result.T = static_cast<long long>(result.C + result.H) - 1 - result.euler;
+
+        if (options.collapse)
+        {
+            // Check χ and T on the cubical complex collapsed by free pairs: it keeps
+            // the homotopy type, and a solid without cavity ends as a graph with T
+            // independent cycles
+            DenseCubicalComplex complex;
+            complex.construct(volume, pool);
+            for (int k = 0; k < 4; ++k)
+                result.cells[k] = complex.nbCells(k);
+            if (complex.euler() != result.euler)
+                throw std::runtime_error("the 2x2x2 table gives χ = " + std::to_string(result.euler) +
+                                         " but the cubical complex " + std::to_string(complex.euler()));
+            complex.collapse(pool);
+            if (complex.nbCells(2) == 0 && complex.nbCells(3) == 0)
+                result.cycles = static_cast<long long>(complex.nbCells(1)) - static_cast<long long>(complex.nbCells(0)) +
+                                static_cast<long long>(result.C);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        result.error = e.what();
+    }
+    result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// Function to print the report of one volume
+void printResult(const VolumeResult &result)
+{
+    std::cout << "=============================" << std::endl;
+    std::cout << "File: " << result.fileName << std::endl;
+    if (!result.error.empty())
+    {
+        std::cerr << "Could not analyze " << result.fileName << ": " << result.error << std::endl;
+        return;
+    }
+    std::cout << "Size: " << result.width << " x " << result.height << " x " << result.depth
+              << ", " << result.voxels << " foreground voxels" << std::endl;
+    if (result.cells[3] > 0)
+    {
+        cout << "0-cells : " << result.cells[0] << endl;
+        cout << "1-cells : " << result.cells[1] << endl;
+        cout << "2-cells : " << result.cells[2] << endl;
+        cout << "3-cells : " << result.cells[3] << endl;
+    }
+    std::cout << "Number of connected components in foreground (C): " << result.C << std::endl;
+    std::cout << "Number of background components (H, the outside included): " << result.H << std::endl;
+    std::cout << "Euler characteristic (χ): " << result.euler << " (6/26: " << result.euler6_26 << ")" << std::endl;
+    std::cout << "Number of tunnels (T): " << result.T << std::endl;
+    if (result.cycles >= 0)
+    {
+        std::cout << "Number of independent cycles of the collapsed complex: " << result.cycles << std::endl;
+        if (result.cycles != result.T)
+            std::cerr << "Warning: the collapsed complex has " << result.cycles << " cycles but T is " << result.T << std::endl;
+    }
+    std::cout << "Time: " << result.milliseconds << " ms" << std::endl;
+}
+
+// Function to write the results as CSV, one line per volume
+void writeResults(const std::vector<VolumeResult> &results, const std::string &fileName)
+{
+    std::ofstream out(fileName);
+    out << "file,width,height,depth,voxels,C,H,euler,euler_6_26,T,cycles,milliseconds,error\n";
+    for (const VolumeResult &result : results)
+    {
+        out << result.fileName << ',' << result.width << ',' << result.height << ',' << result.depth << ','
+            << result.voxels << ',' << result.C << ',' << result.H << ',' << result.euler << ',' << result.euler6_26 << ','
+            << result.T << ',' << result.cycles << ',' << result.milliseconds << ",\"" << result.error << "\"\n";
+    }
+    if (!out)
+        throw std::runtime_error("cannot write " + fileName);
+}
+
+#if defined(WITH_VIEWER)
+// Function to show a volume in the 3D viewer, until its window is closed
+int viewVolume(const std::string &fileName, int argc, char **argv)
+{
+    // make the foreground digital set from the runs of the volume
+    std::vector<VolumeRun> runs;
+    BitVolume volume = readVolumeFile(fileName, &runs);
+    Z3i::Domain domain(Point(0, 0, 0), Point(volume.width() - 1, volume.height() - 1, volume.depth() - 1));
+    Z3i::DigitalSet set_foreground ( domain );                                         // Create a digital set of proper size
+    for (const VolumeRun &run : runs)
+        for (int x = run.xBegin; x < run.xEnd; ++x)
+            set_foreground.insertNew(Point(x, run.y, run.z));
 
     // 3D viewer
     QApplication application(argc,argv);
@@ -94,8 +242,76 @@ int main(int argc, char** argv)
     MyViewer viewer;
     viewer.show();
     //viewer << shape;
-    viewer << SetMode3D(image.domain().className(),"BoundingBox");
-    viewer << set_foreground << image.domain() << MyViewer::updateDisplay;
+    viewer << SetMode3D(domain.className(),"BoundingBox");
+    viewer << set_foreground << domain << MyViewer::updateDisplay;
 
     return application.exec();
-}
\ No newline at end of file
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    setlocale(LC_NUMERIC, "us_US"); //To prevent French local settings
+
+    const TopologyOptions options = parseOptions(argc, argv);
+    const std::vector<std::string> fileNames = listVolumeFiles(options.inputs);
+
+    std::cout << "*****************************" << std::endl;
+    std::cout << "Number of volumes found: " << fileNames.size() << std::endl;
+    std::cout << "*****************************" << std::endl;
+
+    // With at least as many volumes as threads, each volume is analyzed on one
+    // thread; otherwise the volumes are taken one after the other, each on all threads
+    WorkStealingPool pool(options.threads);
+    std::vector<VolumeResult> results(fileNames.size());
+    auto start = std::chrono::steady_clock::now();
+    if (fileNames.size() >= pool.size())
+    {
+        pool.parallelFor(fileNames.size(), [&](size_t i, unsigned)
+        {
+            WorkStealingPool serial(1);
+            results[i] = analyzeVolume(fileNames[i], options, serial);
+        });
+    }
+    else
+    {
+        for (size_t i = 0; i < fileNames.size(); ++i)
+            results[i] = analyzeVolume(fileNames[i], options, pool);
+    }
+    double totalTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    size_t failures = 0;
+    for (const VolumeResult &result : results)
+    {
+        printResult(result);
+        failures += result.error.empty() ? 0 : 1;
+    }
+    std::cout << "=============================" << std::endl;
+    std::cout << fileNames.size() << " volumes in " << totalTime << " ms on " << pool.size() << " threads" << std::endl;
+
+    if (!options.output.empty())
+    {
+        try
+        {
+            writeResults(results, options.output);
+            std::cout << "Results written to " << options.output << std::endl;
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    // The viewer is an opt-in last step, after the whole batch
+    if (options.view && !fileNames.empty())
+    {
+#if defined(WITH_VIEWER)
+        return viewVolume(fileNames.front(), argc, argv);
+#else
+        std::cerr << "--view: TP3 was built without the 3D viewer (TP3_VIEWER=OFF)" << std::endl;
+        return 1;
+#endif
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,258 @@
+#include <DGtal/base/Common.h>
+#include <DGtal/helpers/StdDefs.h>
+#include <DGtal/shapes/GaussDigitizer.h>
+#include <DGtal/shapes/parametric/Ball2D.h>
+#include <DGtal/shapes/parametric/Ellipse2D.h>
+#include <DGtal/shapes/parametric/Flower2D.h>
+#include <DGtal/shapes/parametric/AccFlower2D.h>
+#include <DGtal/shapes/parametric/NGon2D.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <new>
+
+#include "RunLengthLabeling.h"
+#include "ContourTracing.h"
+#include "GrainMeasurement.h"
+
+using namespace std;
+using namespace DGtal;
+using namespace Z2i;
+
+// Multigrid benchmark of the area and perimeter estimators of TP1-2.
+//
+// Analytic shapes are digitized (Gauss digitization) at decreasing grid steps
+// h, labeled and traced exactly like the rice masks, then every estimator is
+// run on the contour of the shape. One CSV line is written per shape, grid
+// step and estimator, with the error against the continuous value, the mean
+// wall time of one call and the number of heap allocations it makes.
+//
+//   ./build/bench-multigrid [--steps 1,0.5,0.25,0.1] [--repeats N] [--output FILE]
+
+// Heap allocations of the whole program, counted by the global operator new
+static std::atomic<size_t> allocationCount{0};
+
+void *operator new(std::size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size > 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+// Continuous area and length of a star-shaped DGtal shape, integrated along its
+// parametrization x(t), t in [0, 2π) (Green's formula for the area)
+struct ShapeTruth
+{
+    double area = 0.0;
+    double perimeter = 0.0;
+};
+
+template <typename TShape>
+ShapeTruth integrateShape(const TShape &shape, int samples = 200000)
+{
+    ShapeTruth truth;
+    const double dt = 2.0 * M_PI / samples;
+    for (int i = 0; i < samples; ++i)
+    {
+        const double t = (i + 0.5) * dt;
+        const auto p = shape.x(t);
+        const auto v = shape.xp(t);
+        truth.area += 0.5 * (p[0] * v[1] - p[1] * v[0]) * dt;
+        truth.perimeter += std::hypot(v[0], v[1]) * dt;
+    }
+    truth.area = std::abs(truth.area);
+    return truth;
+}
+
+// Contour of the largest component of a digitized shape, with its record
+struct DigitizedShape
+{
+    Contour4 contour;
+    GrainRecord record;
+};
+
+// Function to digitize a shape at grid step h and to trace its boundary
+template <typename TShape>
+DigitizedShape digitizeShape(const TShape &shape, double h)
+{
+    typedef GaussDigitizer<Space, TShape> Digitizer;
+    Digitizer digitizer;
+    digitizer.attach(shape);
+    digitizer.init(shape.getLowerBound(), shape.getUpperBound(), h);
+    const Domain domain = digitizer.getDomain();
+
+    // One background pixel around the domain, so the shape never touches the border
+    const Point lower = domain.lowerBound();
+    const Point upper = domain.upperBound();
+    const int width = upper[0] - lower[0] + 3;
+    const int height = upper[1] - lower[1] + 3;
+    std::vector<unsigned char> mask(static_cast<size_t>(width) * height, 0);
+    for (int y = lower[1]; y <= upper[1]; ++y)
+    {
+        for (int x = lower[0]; x <= upper[0]; ++x)
+        {
+            if (digitizer(Point(x, y)))
+                mask[static_cast<size_t>(y - lower[1] + 1) * width + (x - lower[0] + 1)] = 255;
+        }
+    }
+
+    RunLengthLabelMap labelMap = labelRunLength(mask.data(), width, height, width);
+    BinaryMaskView view{mask.data(), width, height, static_cast<size_t>(width), 0, 255};
+    std::vector<TracedContour<Point>> contours = traceOuterContours<Point>(view, labelMap.records);
+
+    DigitizedShape digitized;
+    for (TracedContour<Point> &traced : contours)
+    {
+        const GrainRecord &record = labelMap.records[traced.label - 1];
+        if (record.pixelCount > digitized.record.pixelCount)
+        {
+            digitized.record = record;
+            digitized.contour = std::move(traced.chain);
+        }
+    }
+    return digitized;
+}
+
+// One estimator: what it measures, and how to compute it in grid units
+struct Estimator
+{
+    std::string name;
+    std::string quantity; // "area" or "perimeter"
+    std::function<double(const DigitizedShape &)> estimate;
+};
+
+// Function to list the area and perimeter estimators of TP1-2
+std::vector<Estimator> listEstimators()
+{
+    return {
+        {"cells", "area", [](const DigitizedShape &s)
+         { return static_cast<double>(s.record.pixelCount); }},
+        {"polygon", "area", [](const DigitizedShape &s)
+         { return computeContourMoments(s.contour).area; }},
+        {"cells", "perimeter", [](const DigitizedShape &s)
+         { return static_cast<double>(s.contour.size()); }},
+        {"polygon", "perimeter", [](const DigitizedShape &s)
+         { return computeContourMoments(s.contour).perimeter; }},
+        {"dss", "perimeter", [](const DigitizedShape &s)
+         { return estimateDSSLength(s.contour); }},
+    };
+}
+
+// Options of the benchmark
+struct BenchOptions
+{
+    std::vector<double> steps = {1.0, 0.5, 0.25, 0.1, 0.05};
+    int repeats = 5;
+    std::string output; // CSV file, standard output when empty
+};
+
+BenchOptions parseOptions(int argc, char **argv)
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]()
+        { return i + 1 < argc ? std::string(argv[++i]) : std::string(); };
+
+        if (arg == "--steps")
+        {
+            options.steps.clear();
+            std::stringstream list(value());
+            std::string step;
+            while (std::getline(list, step, ','))
+            {
+                if (std::atof(step.c_str()) > 0.0)
+                    options.steps.push_back(std::atof(step.c_str()));
+            }
+        }
+        else if (arg == "--repeats")
+            options.repeats = std::max(1, std::atoi(value().c_str()));
+        else if (arg == "--output")
+            options.output = value();
+    }
+    return options;
+}
+
+// Function to run every estimator on one shape at every grid step
+template <typename TShape>
+void benchShape(const std::string &shapeName, const TShape &shape, const BenchOptions &options,
+                const std::vector<Estimator> &estimators, std::ostream &csv)
+{
+    const ShapeTruth truth = integrateShape(shape);
+    for (double h : options.steps)
+    {
+        const DigitizedShape digitized = digitizeShape(shape, h);
+        if (digitized.contour.empty())
+        {
+            std::cerr << shapeName << ": empty digitization at h = " << h << std::endl;
+            continue;
+        }
+
+        for (const Estimator &estimator : estimators)
+        {
+            double value = 0.0;
+            const size_t allocationsBefore = allocationCount.load();
+            const auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < options.repeats; ++r)
+                value = estimator.estimate(digitized);
+            const auto stop = std::chrono::steady_clock::now();
+            const size_t allocations = allocationCount.load() - allocationsBefore;
+
+            // Back to the units of the continuous shape
+            const bool isArea = estimator.quantity == "area";
+            const double scaled = value * (isArea ? h * h : h);
+            const double expected = isArea ? truth.area : truth.perimeter;
+            const double seconds = std::chrono::duration<double>(stop - start).count() / options.repeats;
+
+            csv << shapeName << ',' << h << ',' << estimator.quantity << ',' << estimator.name << ','
+                << digitized.contour.size() << ',' << scaled << ',' << expected << ','
+                << std::abs(scaled - expected) << ',' << std::abs(scaled - expected) / expected << ','
+                << seconds * 1e6 << ',' << static_cast<double>(allocations) / options.repeats << '\n';
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const BenchOptions options = parseOptions(argc, argv);
+    const std::vector<Estimator> estimators = listEstimators();
+
+    std::ofstream file;
+    if (!options.output.empty())
+    {
+        file.open(options.output);
+        if (!file)
+        {
+            std::cerr << "Cannot write " << options.output << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &csv = options.output.empty() ? std::cout : file;
+    csv.precision(10);
+    csv << "shape,h,quantity,estimator,contour_steps,estimate,truth,abs_error,rel_error,time_us,allocations\n";
+
+    // Shapes of the size of a rice grain at h = 1 (tens of pixels)
+    benchShape("ball", Ball2D<Space>(0.3, 0.2, 20.0), options, estimators, csv);
+    benchShape("ellipse", Ellipse2D<Space>(0.3, 0.2, 30.0, 12.0, 0.4), options, estimators, csv);
+    benchShape("flower", Flower2D<Space>(0.3, 0.2, 20.0, 6.0, 5, 0.3), options, estimators, csv);
+    benchShape("accflower", AccFlower2D<Space>(0.3, 0.2, 20.0, 6.0, 4, 0.3), options, estimators, csv);
+    benchShape("pentagon", NGon2D<Space>(0.3, 0.2, 20.0, 5, 0.3), options, estimators, csv);
+
+    if (!options.output.empty())
+        std::cout << "Saved multigrid results to: " << options.output << std::endl;
+    return 0;
+}
@@ -0,0 +1,391 @@
+#include <DGtal/base/Common.h>
+#include <DGtal/helpers/StdDefs.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <filesystem>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+#include "RunLengthLabeling.h"
+#include "ContourTracing.h"
+#include "GrainMeasurement.h"
+#include "MappedPGM.h"
+#include "StripLabeling.h"
+#include "RunningStatistics.h"
+#include "WorkStealingPool.h"
+#include "GrainSeparation.h"
+
+using namespace std;
+using namespace DGtal;
+using namespace Z2i;
+
+namespace fs = std::filesystem;
+
+// Stage-level benchmark of the TP1-2 pipeline on synthetic grain fields.
+//
+// The grains of the existing *_seg_bin.pgm masks are cut out, then tiled over
+// a field of any size: every cell of a grid gets a random grain, with a random
+// rotation or mirror and a random offset inside the cell. The field is written
+// as a P5 PGM by bands of cells, so a 50000 x 50000 field never has to fit in
+// memory. Each stage of TP1-2 is then timed on its own (mapping, packing,
+// labeling, border filtering, tracing, measurement, statistics), and the
+// throughput is reported in pixels and grains per second.
+//
+//   ./build/bench-pipeline [--size WxH] [--grains DIR] [--field FILE] [--keep]
+//                          [--overwrite] [-j N] [--seed N] [--strip-height N] [--separate]
+//
+// The field is a scratch file, removed after the run unless --keep: an
+// existing file is never replaced, unless --overwrite is given.
+
+// A grain cut out of a mask: its bounding box as a byte mask (0 or 255)
+struct GrainTemplate
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+};
+
+// Function to cut every grain not touching the border out of the masks of a directory
+std::vector<GrainTemplate> loadGrainTemplates(const std::string &directory)
+{
+    std::vector<GrainTemplate> grains;
+    std::vector<std::string> fileNames;
+    for (const auto &entry : fs::directory_iterator(directory))
+    {
+        if (entry.is_regular_file() && entry.path().filename().string().find("_seg_bin.pgm") != std::string::npos)
+            fileNames.push_back(entry.path().string());
+    }
+    std::sort(fileNames.begin(), fileNames.end());
+
+    for (const std::string &fileName : fileNames)
+    {
+        MappedPGM pgm(fileName);
+        RunLengthLabelMap labelMap = labelRunLength(pgm.pixels(), pgm.width(), pgm.height(), pgm.stride(), 1, 255);
+        const size_t first = grains.size();
+        std::vector<size_t> grainOfLabel(labelMap.records.size() + 1, 0);
+        for (const GrainRecord &record : labelMap.records)
+        {
+            if (record.touchesBorder)
+                continue;
+            GrainTemplate grain;
+            grain.width = record.maxX - record.minX + 1;
+            grain.height = record.maxY - record.minY + 1;
+            grain.pixels.assign(static_cast<size_t>(grain.width) * grain.height, 0);
+            grainOfLabel[record.label] = grains.size() + 1;
+            grains.push_back(std::move(grain));
+        }
+        for (const PixelRun &run : labelMap.runs)
+        {
+            if (grainOfLabel[run.label] == 0)
+                continue;
+            const GrainRecord &record = labelMap.records[run.label - 1];
+            GrainTemplate &grain = grains[grainOfLabel[run.label] - 1];
+            unsigned char *row = grain.pixels.data() + static_cast<size_t>(run.y - record.minY) * grain.width;
+            std::fill(row + (run.xBegin - record.minX), row + (run.xEnd - record.minX), 255);
+        }
+        std::cout << "Cut " << grains.size() - first << " grains out of " << fileName << std::endl;
+    }
+    return grains;
+}
+
+// Function to write a width x height field of tiled grains; returns the number
+// of grains placed entirely inside the field
+size_t writeSyntheticField(const std::string &fileName, int width, int height,
+                           const std::vector<GrainTemplate> &grains, unsigned seed)
+{
+    // Cells large enough for any grain in any orientation, with a background margin
+    int extent = 0;
+    for (const GrainTemplate &grain : grains)
+        extent = std::max(extent, std::max(grain.width, grain.height));
+    const int cell = extent + 4;
+
+    std::FILE *file = std::fopen(fileName.c_str(), "wb");
+    if (file == nullptr)
+        throw std::runtime_error("cannot write " + fileName);
+    std::fprintf(file, "P5\n%d %d\n255\n", width, height);
+
+    std::mt19937 random(seed);
+    std::vector<unsigned char> band;
+    size_t placed = 0;
+    for (int y0 = 0; y0 < height; y0 += cell)
+    {
+        const int rows = std::min(cell, height - y0);
+        band.assign(static_cast<size_t>(cell) * width, 0);
+
+        for (int x0 = 0; x0 < width; x0 += cell)
+        {
+            const GrainTemplate &grain = grains[random() % grains.size()];
+            const int transform = static_cast<int>(random() % 8); // Rotations and mirrors
+            const bool transpose = transform & 4;
+            const int w = transpose ? grain.height : grain.width;
+            const int h = transpose ? grain.width : grain.height;
+            const int offsetX = x0 + 2 + static_cast<int>(random() % (cell - 3 - w + 1));
+            const int offsetY = 2 + static_cast<int>(random() % (cell - 3 - h + 1));
+
+            for (int v = 0; v < h; ++v)
+            {
+                for (int u = 0; u < w; ++u)
+                {
+                    int su = transpose ? v : u;
+                    int sv = transpose ? u : v;
+                    if (transform & 1)
+                        su = grain.width - 1 - su;
+                    if (transform & 2)
+                        sv = grain.height - 1 - sv;
+                    const int x = offsetX + u;
+                    if (x < width && grain.pixels[static_cast<size_t>(sv) * grain.width + su])
+                        band[static_cast<size_t>(offsetY + v) * width + x] = 255;
+                }
+            }
+            if (offsetX + w < width && y0 + offsetY + h < height)
+                ++placed;
+        }
+
+        if (std::fwrite(band.data(), 1, static_cast<size_t>(rows) * width, file) != static_cast<size_t>(rows) * width)
+        {
+            std::fclose(file);
+            throw std::runtime_error("cannot write " + fileName);
+        }
+    }
+    std::fclose(file);
+    return placed;
+}
+
+// Options of the benchmark
+struct BenchOptions
+{
+    int width = 8000;
+    int height = 8000;
+    std::string grains = "resources/";
+    std::string field = "synthetic_field.pgm";
+    bool keep = false; // Keep the synthetic field after the run
+    bool overwrite = false; // Replace the field file when it already exists
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    unsigned seed = 1;
+    int stripHeight = 0; // Also time the strip by strip path when > 0
+    bool separate = false; // Also time the separation of touching grains (STEP 10)
+};
+
+BenchOptions parseOptions(int argc, char **argv)
+{
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto value = [&]()
+        { return i + 1 < argc ? std::string(argv[++i]) : std::string(); };
+        auto count = [&]()
+        { return std::max(1, std::atoi(value().c_str())); };
+
+        if (arg == "--size")
+        {
+            int w = 0, h = 0;
+            if (std::sscanf(value().c_str(), "%dx%d", &w, &h) == 2 && w > 0 && h > 0)
+            {
+                options.width = w;
+                options.height = h;
+            }
+        }
+        else if (arg == "--grains")
+            options.grains = value();
+        else if (arg == "--field")
+            options.field = value();
+        else if (arg == "--keep")
+            options.keep = true;
+        else if (arg == "--overwrite")
+            options.overwrite = true;
+        else if (arg == "-j" || arg == "--threads")
+            options.threads = static_cast<unsigned>(count());
+        else if (arg == "--seed")
+            options.seed = static_cast<unsigned>(std::atoi(value().c_str()));
+        else if (arg == "--strip-height")
+            options.stripHeight = count();
+        else if (arg == "--separate")
+            options.separate = true;
+    }
+    return options;
+}
+
+// Timer of the successive stages, printing one line per stage
+class StageTimer
+{
+public:
+    StageTimer(double pixels) : myPixels(pixels), myStart(std::chrono::steady_clock::now()) {}
+
+    // Function to close the current stage; grains is the number of grains it handled
+    void stage(const std::string &name, double grains)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(now - myStart).count();
+        myTotal += seconds;
+        std::printf("%-22s %10.3f s %12.1f Mpixel/s %14.0f grains/s\n", name.c_str(), seconds,
+                    myPixels / seconds / 1e6, grains / seconds);
+        myStart = std::chrono::steady_clock::now();
+    }
+
+    double total() const { return myTotal; }
+
+private:
+    double myPixels;
+    std::chrono::steady_clock::time_point myStart;
+    double myTotal = 0.0;
+};
+
+int main(int argc, char **argv)
+{
+    const BenchOptions options = parseOptions(argc, argv);
+    const double pixels = static_cast<double>(options.width) * options.height;
+
+    // ============================
+    // SYNTHETIC FIELD
+    // ============================
+
+    std::error_code error;
+    if (fs::exists(options.field, error) && !options.overwrite)
+    {
+        std::cerr << options.field << " already exists; choose another --field FILE or add --overwrite" << std::endl;
+        return 1;
+    }
+
+    std::vector<GrainTemplate> grains = loadGrainTemplates(options.grains);
+    if (grains.empty())
+    {
+        std::cerr << "No grains found in " << options.grains << std::endl;
+        return 1;
+    }
+    auto generationStart = std::chrono::steady_clock::now();
+    const size_t placed = writeSyntheticField(options.field, options.width, options.height, grains, options.seed);
+    std::cout << "Wrote " << options.width << " x " << options.height << " field with " << placed
+              << " inner grains to " << options.field << " in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - generationStart).count()
+              << " s" << std::endl;
+
+    // ============================
+    // STAGES OF TP1-2
+    // ============================
+
+    WorkStealingPool pool(options.threads);
+    std::cout << "-----------------------------" << std::endl;
+    std::cout << "Stages on " << pool.size() << " threads:" << std::endl;
+    StageTimer timer(pixels);
+
+    MappedPGM pgm(options.field);
+    timer.stage("map", 0.0);
+
+    PackedBitmap bitmap = packBitmap(pgm.pixels(), pgm.width(), pgm.height(), pgm.stride(), 1, 255);
+    timer.stage("pack", 0.0);
+
+    RunLengthLabelMap labelMap = labelRunLength(bitmap.words.data(), bitmap.width, bitmap.height, bitmap.wordsPerRow);
+    timer.stage("label", static_cast<double>(labelMap.records.size()));
+
+    size_t removed = 0;
+    for (const GrainRecord &record : labelMap.records)
+    {
+        if (record.touchesBorder)
+            ++removed;
+    }
+    timer.stage("border filtering", static_cast<double>(labelMap.records.size()));
+
+    std::vector<TracedContour<Point>> contours = traceOuterContours<Point>(bitmap, labelMap.records);
+    timer.stage("trace", static_cast<double>(contours.size()));
+
+    PerimeterEstimators estimators;
+    std::vector<GrainMeasurement> measurements(contours.size());
+    pool.parallelFor(contours.size(), [&](size_t i, unsigned)
+                     { measurements[i] = measureGrain(contours[i].chain, labelMap.records[contours[i].label - 1],
+                                                      estimators); });
+    timer.stage("measure", static_cast<double>(contours.size()));
+
+    RunningStatistics areas_2cells, areas_polygon, perimeters_boundary, perimeters_polygon, circularities;
+    for (const GrainMeasurement &measurement : measurements)
+    {
+        areas_2cells.add(measurement.area_2cells);
+        areas_polygon.add(measurement.area_polygon);
+        perimeters_boundary.add(measurement.perimeter_boundary);
+        perimeters_polygon.add(measurement.perimeter_polygon);
+        circularities.add(measurement.circularity);
+    }
+    const double median = circularities.median();
+    timer.stage("statistics", static_cast<double>(measurements.size()));
+
+    std::printf("%-22s %10.3f s %12.1f Mpixel/s %14.0f grains/s\n", "total", timer.total(),
+                pixels / timer.total() / 1e6, contours.size() / timer.total());
+    std::cout << "Components: " << labelMap.records.size() << ", removed: " << removed
+              << ", measured: " << contours.size() << ", median circularity: " << median << std::endl;
+    if (contours.size() != placed)
+        std::cerr << "Warning: " << placed << " grains were placed inside the field" << std::endl;
+
+    // ============================
+    // STRIP BY STRIP
+    // ============================
+
+    if (options.stripHeight > 0)
+    {
+        std::cout << "-----------------------------" << std::endl;
+        std::cout << "Strips of " << options.stripHeight << " rows:" << std::endl;
+        StageTimer stripTimer(pixels);
+
+        PGMStripReader reader(options.field);
+        StripLabeler labeler(reader.width(), reader.height());
+        std::vector<unsigned char> strip;
+        std::vector<uint64_t> bits(labeler.wordsPerRow());
+        size_t measured = 0;
+        size_t maxRetainedRows = 0;
+        auto onComplete = [&](const GrainRecord &record)
+        {
+            if (record.touchesBorder)
+                return;
+            const Contour4 chain = traceOuterChain<Point>(labeler, record.startX, record.startY);
+            measureGrain(chain, record, estimators);
+            ++measured;
+        };
+        for (int y0 = 0; y0 < reader.height(); y0 += options.stripHeight)
+        {
+            const int rows = std::min(options.stripHeight, reader.height() - y0);
+            reader.readRows(y0, rows, strip);
+            for (int r = 0; r < rows; ++r)
+            {
+                std::fill(bits.begin(), bits.end(), 0);
+                packRow(strip.data() + static_cast<size_t>(r) * reader.width(), reader.width(), 1, 255, bits.data());
+                labeler.pushRow(bits.data(), onComplete);
+                maxRetainedRows = std::max(maxRetainedRows, labeler.retainedRows());
+            }
+        }
+        labeler.finish(onComplete);
+        stripTimer.stage("read, label, trace, measure", static_cast<double>(measured));
+        std::cout << "Measured: " << measured << ", at most " << maxRetainedRows << " rows held" << std::endl;
+    }
+
+    // ============================
+    // SEPARATION OF TOUCHING GRAINS
+    // ============================
+
+    if (options.separate)
+    {
+        std::cout << "-----------------------------" << std::endl;
+        std::cout << "Separation of touching grains:" << std::endl;
+        StageTimer separationTimer(pixels);
+
+        const PackedBitmap separated = separateTouchingGrains(labelMap, 2.0, pool);
+        separationTimer.stage("distance, watershed, cut", static_cast<double>(labelMap.records.size()));
+
+        RunLengthLabelMap separatedMap = labelRunLength(separated.words.data(), separated.width, separated.height,
+                                                        separated.wordsPerRow);
+        separationTimer.stage("label", static_cast<double>(separatedMap.records.size()));
+        std::cout << "Components: " << labelMap.records.size() << " before, " << separatedMap.records.size()
+                  << " after" << std::endl;
+    }
+
+    pgm.close();
+    if (!options.keep)
+        std::remove(options.field.c_str());
+    std::cout << "=============================" << std::endl;
+    return 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+// Dense binary volume, one bit per voxel.
+//
+// Voxels are packed along x, 64 per word; every row (y, z) starts on a word
+// boundary, rows are stored by increasing y, then slices by increasing z. A
+// 512^3 volume takes 16 MB, against several gigabytes for a DigitalSet or a
+// map-based cubical complex. Voxels outside the volume read as background.
+// Coordinates are relative to the first voxel of the domain.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class BitVolume
+{
+public:
+    BitVolume() = default;
+    BitVolume(int width, int height, int depth)
+        : myWidth(width), myHeight(height), myDepth(depth), myWordsPerRow((static_cast<size_t>(width) + 63) / 64),
+          myWords(myWordsPerRow * static_cast<size_t>(height) * static_cast<size_t>(depth), 0) {}
+
+    int width() const { return myWidth; }
+    int height() const { return myHeight; }
+    int depth() const { return myDepth; }
+    size_t wordsPerRow() const { return myWordsPerRow; }
+
+    const uint64_t *row(int y, int z) const { return myWords.data() + rowOffset(y, z); }
+    uint64_t *row(int y, int z) { return myWords.data() + rowOffset(y, z); }
+
+    bool operator()(int x, int y, int z) const
+    {
+        if (x < 0 || y < 0 || z < 0 || x >= myWidth || y >= myHeight || z >= myDepth)
+            return false;
+        return (row(y, z)[x >> 6] >> (x & 63)) & 1u;
+    }
+
+    void set(int x, int y, int z, bool value = true)
+    {
+        uint64_t &word = row(y, z)[x >> 6];
+        const uint64_t bit = uint64_t(1) << (x & 63);
+        word = value ? (word | bit) : (word & ~bit);
+    }
+
+    // Function to count the foreground voxels
+    size_t count() const
+    {
+        size_t total = 0;
+        for (uint64_t word : myWords)
+            total += static_cast<size_t>(__builtin_popcountll(word));
+        return total;
+    }
+
+private:
+    size_t rowOffset(int y, int z) const
+    {
+        return (static_cast<size_t>(z) * myHeight + static_cast<size_t>(y)) * myWordsPerRow;
+    }
+
+    int myWidth = 0;
+    int myHeight = 0;
+    int myDepth = 0;
+    size_t myWordsPerRow = 0;
+    std::vector<uint64_t> myWords;
+};
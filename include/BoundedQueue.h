@@ -0,0 +1,66 @@
+#pragma once
+
+// Blocking FIFO queue with a fixed capacity, used between pipeline stages.
+//
+// push() blocks while the queue is full, which gives backpressure: a fast
+// producer cannot get more than `capacity` items ahead of its consumer.
+// close() wakes everybody up; pop() then drains the remaining items and
+// returns false once the queue is empty.
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : myCapacity(capacity > 0 ? capacity : 1) {}
+
+    // Function to add an item; returns false if the queue was closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(myMutex);
+        myNotFull.wait(lock, [this] { return myClosed || myItems.size() < myCapacity; });
+        if (myClosed)
+            return false;
+        myItems.push_back(std::move(item));
+        lock.unlock();
+        myNotEmpty.notify_one();
+        return true;
+    }
+
+    // Function to take the oldest item; returns false once closed and empty
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(myMutex);
+        myNotEmpty.wait(lock, [this] { return myClosed || !myItems.empty(); });
+        if (myItems.empty())
+            return false;
+        item = std::move(myItems.front());
+        myItems.pop_front();
+        lock.unlock();
+        myNotFull.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> guard(myMutex);
+            myClosed = true;
+        }
+        myNotEmpty.notify_all();
+        myNotFull.notify_all();
+    }
+
+private:
+    const size_t myCapacity;
+    std::deque<T> myItems;
+    std::mutex myMutex;
+    std::condition_variable myNotEmpty;
+    std::condition_variable myNotFull;
+    bool myClosed = false;
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+// Single-pass shape descriptors of a closed 4-connected Freeman chain.
+//
+// The chain is walked once, step by step, without building the vertex list.
+// Green's theorem turns the area integrals of the polygon bounded by the chain
+// into sums over its edges, so the area, the first and the second order
+// moments are accumulated together with the length and the bounding box.
+// Moments are accumulated exactly, in integers and relative to the start
+// point, then converted to centroid, orientation, elongation and eccentricity.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+struct ContourMoments
+{
+    double area = 0.0;      // Area enclosed by the chain (Shoelace formula)
+    double perimeter = 0.0; // Length of the chain
+    double centroidX = 0.0, centroidY = 0.0;
+    int minX = 0, minY = 0, maxX = 0, maxY = 0; // Bounding box of the chain points
+
+    // Central second order moments of the enclosed region
+    double mu20 = 0.0, mu02 = 0.0, mu11 = 0.0;
+
+    double orientation = 0.0;  // Angle of the major axis with the x axis, in radians
+    double elongation = 1.0;   // Major over minor axis length
+    double eccentricity = 0.0; // Of the ellipse with the same second moments, in [0, 1)
+};
+
+// Function to compute the descriptors of a closed chain (PackedFreemanChain).
+// An open chain is treated as if closed by a straight edge back to its start.
+template <typename TChain>
+ContourMoments computeContourMoments(const TChain &chain)
+{
+    ContourMoments moments;
+    const int x0 = chain.firstPoint()[0];
+    const int y0 = chain.firstPoint()[1];
+    moments.minX = moments.maxX = x0;
+    moments.minY = moments.maxY = y0;
+
+    // Edge sums, in coordinates relative to (x0, y0):
+    //   a2 = 2 A, mx6 = 6 Sx, my6 = 6 Sy, mxx12 = 12 Sxx, myy12 = 12 Syy, mxy24 = 24 Sxy
+    int64_t a2 = 0, mx6 = 0, my6 = 0, mxx12 = 0, myy12 = 0, mxy24 = 0;
+    auto addEdge = [&](int64_t xa, int64_t ya, int64_t xb, int64_t yb)
+    {
+        const int64_t cross = xa * yb - xb * ya;
+        a2 += cross;
+        mx6 += (xa + xb) * cross;
+        my6 += (ya + yb) * cross;
+        mxx12 += (xa * xa + xa * xb + xb * xb) * cross;
+        myy12 += (ya * ya + ya * yb + yb * yb) * cross;
+        mxy24 += (xa * yb + 2 * xa * ya + 2 * xb * yb + xb * ya) * cross;
+    };
+
+    int x = 0, y = 0;
+    const size_t steps = chain.size();
+    for (size_t i = 0; i < steps; ++i)
+    {
+        const int code = chain.code(i);
+        const int nx = x + TChain::dx(code);
+        const int ny = y + TChain::dy(code);
+        addEdge(x, y, nx, ny);
+        x = nx;
+        y = ny;
+        moments.minX = std::min(moments.minX, x0 + x);
+        moments.maxX = std::max(moments.maxX, x0 + x);
+        moments.minY = std::min(moments.minY, y0 + y);
+        moments.maxY = std::max(moments.maxY, y0 + y);
+    }
+    addEdge(x, y, 0, 0);
+
+    // Every step is a unit move
+    moments.perimeter = static_cast<double>(steps) + std::hypot(static_cast<double>(x), static_cast<double>(y));
+
+    if (a2 == 0)
+        return moments;
+
+    // Same values whichever way the chain turns
+    const double sign = a2 > 0 ? 1.0 : -1.0;
+    const double area = sign * static_cast<double>(a2) / 2.0;
+    const double cx = sign * static_cast<double>(mx6) / 6.0 / area;
+    const double cy = sign * static_cast<double>(my6) / 6.0 / area;
+    moments.area = area;
+    moments.centroidX = x0 + cx;
+    moments.centroidY = y0 + cy;
+
+    // Central moments, normalized by the area
+    moments.mu20 = sign * static_cast<double>(mxx12) / 12.0 / area - cx * cx;
+    moments.mu02 = sign * static_cast<double>(myy12) / 12.0 / area - cy * cy;
+    moments.mu11 = sign * static_cast<double>(mxy24) / 24.0 / area - cx * cy;
+
+    // Principal axes: eigenvalues of the covariance matrix
+    const double halfSum = (moments.mu20 + moments.mu02) / 2.0;
+    const double halfDiff = (moments.mu20 - moments.mu02) / 2.0;
+    const double radius = std::sqrt(halfDiff * halfDiff + moments.mu11 * moments.mu11);
+    const double major = halfSum + radius;
+    const double minor = halfSum - radius;
+    moments.orientation = 0.5 * std::atan2(2.0 * moments.mu11, moments.mu20 - moments.mu02);
+    if (minor > 0.0)
+    {
+        moments.elongation = std::sqrt(major / minor);
+        moments.eccentricity = std::sqrt(1.0 - minor / major);
+    }
+    return moments;
+}
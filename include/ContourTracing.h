@@ -0,0 +1,135 @@
+#pragma once
+
+// Raster-sweep extraction of the outer boundaries of all grains.
+//
+// In the spirit of Suzuki's border following, every component is traced
+// once, starting from its first pixel in raster order (which the run-length
+// labeler records). The contour follows the inter-pixel boundary (the 1-cells
+// between the grain and its background) counterclockwise, keeping the grain on
+// its left, and emits 4-connected Freeman codes as it goes:
+//
+//     0: East (+x), 1: North (+y), 2: West (-x), 3: South (-y)
+//
+// Vertices are pixel corners: pixel (x, y) covers [x, x + 1] x [y, y + 1].
+// The foreground is 4-connected, so at a corner shared by two diagonal grain
+// pixels the contour turns to keep them apart. Since every pixel met by the
+// tracer is 4-adjacent to the grain being followed, a plain foreground test
+// is enough: no label lookups and no per-component KSpace are needed.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "RunLengthLabeling.h"
+#include "PackedFreemanChain.h"
+
+// Read-only view of an 8-bit mask; a pixel is foreground when minValue < v <= maxValue
+struct BinaryMaskView
+{
+    const unsigned char *pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    size_t stride = 0;
+    unsigned char minValue = 1;
+    unsigned char maxValue = 255;
+
+    bool operator()(int x, int y) const
+    {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return false;
+        unsigned char v = pixels[static_cast<size_t>(y) * stride + static_cast<size_t>(x)];
+        return v > minValue && v <= maxValue;
+    }
+};
+
+// Freeman code displacements
+const int freemanDx[4] = {1, 0, -1, 0};
+const int freemanDy[4] = {0, 1, 0, -1};
+
+// Pixels ahead of a vertex, to the left and to the right of each direction
+const int aheadLeftDx[4] = {0, -1, -1, 0};
+const int aheadLeftDy[4] = {0, 0, -1, -1};
+const int aheadRightDx[4] = {0, 0, -1, -1};
+const int aheadRightDy[4] = {-1, 0, 0, -1};
+
+// Function to follow the outer boundary of the component whose first pixel
+// in raster order is (startX, startY). emit(code) is called for every step;
+// the chain starts and ends at the corner (startX, startY).
+template <typename TMask, typename TEmit>
+void traceOuterContour(const TMask &isForeground, int startX, int startY, TEmit &&emit)
+{
+    // The pixel below and the pixel to the left of the first pixel are
+    // background, so the bottom edge of the first pixel is on the boundary.
+    int x = startX + 1;
+    int y = startY;
+    int d = 0;
+    emit(0);
+
+    // The start corner touches a single grain pixel: it is visited only once.
+    while (x != startX || y != startY)
+    {
+        bool left = isForeground(x + aheadLeftDx[d], y + aheadLeftDy[d]);
+        if (!left)
+        {
+            d = (d + 1) & 3; // Turn left
+        }
+        else if (isForeground(x + aheadRightDx[d], y + aheadRightDy[d]))
+        {
+            d = (d + 3) & 3; // Turn right
+        }
+
+        x += freemanDx[d];
+        y += freemanDy[d];
+        emit(d);
+    }
+}
+
+// Outer boundary of one grain as a packed Freeman chain
+template <typename TPoint>
+struct TracedContour
+{
+    uint32_t label = 0;
+    PackedFreemanChain<TPoint> chain;
+};
+
+// Function to trace the outer boundary of one grain into a chain starting at
+// (originX + startX, originY + startY). The steps go to a scratch chain owned
+// by the calling thread, whose words are kept from one grain and one file to
+// the next, so tracing itself never allocates; the result is then copied out
+// with an exact-size buffer: one allocation per grain instead of one per
+// doubling of the chain.
+template <typename TPoint, typename TMask>
+PackedFreemanChain<TPoint> traceOuterChain(const TMask &isForeground, int startX, int startY,
+                                           int originX = 0, int originY = 0)
+{
+    static thread_local PackedFreemanChain<TPoint> scratch;
+    scratch.reset(originX + startX, originY + startY);
+    traceOuterContour(isForeground, startX, startY,
+                      [](int code)
+                      { scratch.push_back(code); });
+    return scratch;
+}
+
+// Function to trace the outer boundary of every grain that does not touch
+// the image border. Contours come out in label order, i.e. in the raster
+// order of their start points. (originX, originY) is the coordinate of the
+// first pixel of the buffer.
+template <typename TPoint, typename TMask>
+std::vector<TracedContour<TPoint>> traceOuterContours(const TMask &isForeground, const std::vector<GrainRecord> &records,
+                                                      int originX = 0, int originY = 0)
+{
+    std::vector<TracedContour<TPoint>> contours;
+    contours.reserve(static_cast<size_t>(std::count_if(records.begin(), records.end(), [](const GrainRecord &record)
+                                                       { return !record.touchesBorder; })));
+    for (const GrainRecord &record : records)
+    {
+        if (record.touchesBorder)
+            continue;
+
+        contours.emplace_back();
+        contours.back().label = record.label;
+        contours.back().chain = traceOuterChain<TPoint>(isForeground, record.startX, record.startY, originX, originY);
+    }
+    return contours;
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+// Background renderer of the DSS decompositions of all the grains of a file.
+//
+// Board2D keeps every shape in memory until saveSVG() and draws one grain per
+// file. DSSRenderer takes the contours of a whole file once it is reported,
+// decomposes them on its own thread and writes each grain as soon as it is
+// decomposed, so memory is bounded by the queue of pending files and the
+// measurements never wait for the drawing.
+//
+// Each grain is drawn as two paths: its pixel boundary, with consecutive steps
+// in the same direction merged into one h/v command, and the polygon through
+// the end points of its greedy DSS segments. Coordinates are pixel corners,
+// y pointing down as in the image. EPS output uses the same paths with
+// relative PostScript moves, 16 per line.
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "BoundedQueue.h"
+#include "ContourTracing.h"
+#include "GrainMeasurement.h"
+
+// Contours of one file to draw, with their measurements (for the bounding boxes)
+struct RenderJob
+{
+    std::string outputName; // File to write, extension included
+    std::vector<TracedContour<DGtal::Z2i::Point>> contours;
+    std::vector<GrainMeasurement> measurements;
+};
+
+class DSSRenderer
+{
+public:
+    enum Format
+    {
+        SVG,
+        EPS
+    };
+
+    // sampleEvery: draw one grain out of sampleEvery; queueCapacity: files
+    // waiting to be drawn before submit() blocks
+    DSSRenderer(Format format, size_t sampleEvery, size_t queueCapacity)
+        : myFormat(format), mySampleEvery(sampleEvery > 0 ? sampleEvery : 1), myJobs(queueCapacity),
+          myThread(&DSSRenderer::renderLoop, this) {}
+
+    ~DSSRenderer() { finish(); }
+
+    DSSRenderer(const DSSRenderer &) = delete;
+    DSSRenderer &operator=(const DSSRenderer &) = delete;
+
+    const char *extension() const { return myFormat == SVG ? ".svg" : ".eps"; }
+
+    // Function to queue the contours of a file; blocks while the queue is full
+    void submit(RenderJob job) { myJobs.push(std::move(job)); }
+
+    // Function to draw the remaining files and stop the thread
+    void finish()
+    {
+        myJobs.close();
+        if (myThread.joinable())
+            myThread.join();
+    }
+
+private:
+    void renderLoop()
+    {
+        RenderJob job;
+        while (myJobs.pop(job))
+        {
+            try
+            {
+                render(job);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Rendering failed for " << job.outputName << ": " << e.what() << std::endl;
+            }
+            job = RenderJob();
+        }
+    }
+
+    void render(const RenderJob &job)
+    {
+        // Frame of the drawn grains, with a one pixel margin
+        int minX = 0, minY = 0, maxX = 0, maxY = 0;
+        bool first = true;
+        for (size_t i = 0; i < job.measurements.size(); i += mySampleEvery)
+        {
+            const ContourMoments &moments = job.measurements[i].moments;
+            minX = first ? moments.minX : std::min(minX, moments.minX);
+            minY = first ? moments.minY : std::min(minY, moments.minY);
+            maxX = first ? moments.maxX : std::max(maxX, moments.maxX);
+            maxY = first ? moments.maxY : std::max(maxY, moments.maxY);
+            first = false;
+        }
+        minX -= 1;
+        minY -= 1;
+        maxX += 1;
+        maxY += 1;
+
+        std::vector<char> buffer(1 << 16); // Must outlive the file, which flushes into it on close
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(std::fopen(job.outputName.c_str(), "w"), &std::fclose);
+        if (!file)
+            throw std::runtime_error("cannot write " + job.outputName);
+        std::FILE *out = file.get();
+        std::setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+
+        if (myFormat == SVG)
+        {
+            std::fprintf(out, "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"%d %d %d %d\" width=\"%d\" height=\"%d\">\n",
+                         minX, minY, maxX - minX, maxY - minY, maxX - minX, maxY - minY);
+            std::fprintf(out, "<style>path{fill:none;stroke-width:.3}.b{stroke:#888}.d{stroke:#00f}</style>\n");
+        }
+        else
+        {
+            std::fprintf(out, "%%!PS-Adobe-3.0 EPSF-3.0\n%%%%BoundingBox: 0 0 %d %d\n", maxX - minX, maxY - minY);
+            std::fprintf(out, "/m {moveto} def /l {rlineto} def /b {0.5 setgray stroke} def /d {0 0 1 setrgbcolor stroke} def\n");
+            std::fprintf(out, "0.3 setlinewidth 0 %d translate 1 -1 scale %d %d translate\n", maxY - minY, -minX, -minY);
+        }
+
+        std::vector<DGtal::Z2i::Point> vertices;
+        for (size_t i = 0; i < job.contours.size(); i += mySampleEvery)
+        {
+            const Contour4 &chain = job.contours[i].chain;
+            if (chain.empty())
+                continue;
+            writeBoundary(out, chain);
+
+            // End points of the greedy DSS segments
+            vertices.clear();
+            Decomposition4 theDecomposition(chain.begin(), chain.end(), DSS4());
+            for (auto itSeg = theDecomposition.begin(); itSeg != theDecomposition.end(); ++itSeg)
+            {
+                if (vertices.empty())
+                    vertices.push_back(itSeg->back());
+                vertices.push_back(itSeg->front());
+            }
+            writePolygon(out, vertices);
+        }
+
+        std::fprintf(out, myFormat == SVG ? "</svg>\n" : "showpage\n%%%%EOF\n");
+        if (std::ferror(out))
+            throw std::runtime_error("cannot write " + job.outputName);
+    }
+
+    // Function to write the pixel boundary, one command per straight run of steps
+    void writeBoundary(std::FILE *out, const Contour4 &chain) const
+    {
+        const DGtal::Z2i::Point &start = chain.firstPoint();
+        std::fprintf(out, myFormat == SVG ? "<path class=\"b\" d=\"M%d %d" : "%d %d m", start[0], start[1]);
+        size_t i = 0;
+        size_t commands = 0;
+        while (i < chain.size())
+        {
+            const int code = chain.code(i);
+            int length = 0;
+            for (; i < chain.size() && chain.code(i) == code; ++i)
+                ++length;
+            const int dx = Contour4::dx(code) * length;
+            const int dy = Contour4::dy(code) * length;
+            if (myFormat == SVG)
+                std::fprintf(out, dx != 0 ? "h%d" : "v%d", dx != 0 ? dx : dy);
+            else
+                std::fprintf(out, ++commands % 16 == 0 ? "\n%d %d l" : " %d %d l", dx, dy);
+        }
+        std::fprintf(out, myFormat == SVG ? "Z\"/>\n" : " closepath b\n");
+    }
+
+    // Function to write a closed polygon with relative moves
+    void writePolygon(std::FILE *out, const std::vector<DGtal::Z2i::Point> &vertices) const
+    {
+        if (vertices.empty())
+            return;
+        std::fprintf(out, myFormat == SVG ? "<path class=\"d\" d=\"M%d %d" : "%d %d m", vertices[0][0], vertices[0][1]);
+        for (size_t k = 1; k < vertices.size(); ++k)
+        {
+            std::fprintf(out, myFormat == SVG ? "l%d %d" : (k % 16 == 0 ? "\n%d %d l" : " %d %d l"),
+                         vertices[k][0] - vertices[k - 1][0], vertices[k][1] - vertices[k - 1][1]);
+        }
+        std::fprintf(out, myFormat == SVG ? "Z\"/>\n" : " closepath d\n");
+    }
+
+    Format myFormat;
+    size_t mySampleEvery;
+    BoundedQueue<RenderJob> myJobs;
+    std::thread myThread;
+};
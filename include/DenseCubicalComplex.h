@@ -0,0 +1,331 @@
+#pragma once
+
+// Cubical complex stored as one bit per cell of a dense Khalimsky grid.
+//
+// For a volume of W x H x D voxels, the cells of the closed unit cubes have
+// Khalimsky coordinates in [0, 2W] x [0, 2H] x [0, 2D]: voxel (x, y, z) is the
+// 3-cell (2x + 1, 2y + 1, 2z + 1), and the dimension of a cell is the number
+// of its odd coordinates, as in DGtal's KhalimskySpaceND. Rows along x are
+// packed 64 cells per word, like BitVolume, so the grid takes 8 times the
+// memory of the BitVolume and lookups are a shift and a mask instead of the
+// tree walks of CubicalComplex<KSpace, std::map<Cell, CubicalCellData>>.
+//
+// construct() builds the closure of the voxels, one z slice of the grid per
+// task: a row of cells is the OR of at most four rows of voxels, spread to
+// the odd positions and widened by one cell on each side.
+//
+// collapse() removes free pairs (a cell with a single coface, which has no
+// coface itself) until none is left. The result has the homotopy type of the
+// complex: a solid with T tunnels and no cavity usually collapses to a graph
+// with T independent cycles. Cells for which isFixed() is true are kept,
+// e.g. to anchor a skeleton.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "BitVolume.h"
+#include "WorkStealingPool.h"
+
+// Cell of a Khalimsky grid; the dimension is the number of odd coordinates
+struct KhalimskyCell
+{
+    int32_t x;
+    int32_t y;
+    int32_t z;
+
+    int dim() const { return (x & 1) + (y & 1) + (z & 1); }
+    bool operator==(const KhalimskyCell &other) const { return x == other.x && y == other.y && z == other.z; }
+};
+
+// Function to move the 32 bits of v to the even bits of a 64-bit word
+inline uint64_t spreadBits(uint32_t v)
+{
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+class DenseCubicalComplex
+{
+public:
+    DenseCubicalComplex() = default;
+
+    int width() const { return myWidth; }
+    int height() const { return myHeight; }
+    int depth() const { return myDepth; }
+
+    // Function to make the complex the closure of the foreground voxels of a volume
+    void construct(const BitVolume &volume, WorkStealingPool &pool)
+    {
+        myWidth = 2 * volume.width() + 1;
+        myHeight = 2 * volume.height() + 1;
+        myDepth = 2 * volume.depth() + 1;
+        myWordsPerRow = (static_cast<size_t>(myWidth) + 63) / 64;
+        myWords.assign(myWordsPerRow * static_cast<size_t>(myHeight) * static_cast<size_t>(myDepth), 0);
+
+        pool.parallelFor(static_cast<size_t>(myDepth), [&](size_t kz, unsigned)
+        {
+            std::vector<uint64_t> voxels(volume.wordsPerRow());
+            std::vector<uint64_t> odd(myWordsPerRow + 1);
+            for (int ky = 0; ky < myHeight; ++ky)
+            {
+                // Voxel rows around the row of cells: one along an odd coordinate, two along an even one
+                std::fill(voxels.begin(), voxels.end(), 0);
+                bool any = false;
+                for (int z = (static_cast<int>(kz) - 1) / 2; z <= static_cast<int>(kz) / 2; ++z)
+                {
+                    for (int y = (ky - 1) / 2; y <= ky / 2; ++y)
+                    {
+                        if (z < 0 || y < 0 || z >= volume.depth() || y >= volume.height())
+                            continue;
+                        const uint64_t *row = volume.row(y, z);
+                        for (size_t k = 0; k < voxels.size(); ++k)
+                            voxels[k] |= row[k];
+                        any = true;
+                    }
+                }
+                if (!any)
+                    continue;
+
+                // Voxel x is the cell 2x + 1; cells 2x and 2x + 2 are its faces along x
+                std::fill(odd.begin(), odd.end(), 0);
+                for (size_t k = 0; k < voxels.size(); ++k)
+                {
+                    odd[2 * k] = spreadBits(static_cast<uint32_t>(voxels[k])) << 1;
+                    if (2 * k + 1 < odd.size())
+                        odd[2 * k + 1] = spreadBits(static_cast<uint32_t>(voxels[k] >> 32)) << 1;
+                }
+                uint64_t *cells = row(ky, static_cast<int>(kz));
+                for (size_t k = 0; k < myWordsPerRow; ++k)
+                {
+                    const uint64_t previous = k > 0 ? odd[k - 1] : 0;
+                    cells[k] = odd[k] | (odd[k] >> 1) | (odd[k + 1] << 63) | (odd[k] << 1) | (previous >> 63);
+                }
+                if (myWidth % 64 != 0)
+                    cells[myWordsPerRow - 1] &= (uint64_t(1) << (myWidth % 64)) - 1;
+            }
+        });
+    }
+
+    bool contains(const KhalimskyCell &cell) const
+    {
+        if (cell.x < 0 || cell.y < 0 || cell.z < 0 || cell.x >= myWidth || cell.y >= myHeight || cell.z >= myDepth)
+            return false;
+        return (row(cell.y, cell.z)[cell.x >> 6] >> (cell.x & 63)) & 1u;
+    }
+
+    void insertCell(const KhalimskyCell &cell) { row(cell.y, cell.z)[cell.x >> 6] |= uint64_t(1) << (cell.x & 63); }
+    void eraseCell(const KhalimskyCell &cell) { row(cell.y, cell.z)[cell.x >> 6] &= ~(uint64_t(1) << (cell.x & 63)); }
+
+    // Function to count the cells of dimension dim
+    size_t nbCells(int dim) const
+    {
+        size_t total = 0;
+        for (int kz = 0; kz < myDepth; ++kz)
+        {
+            for (int ky = 0; ky < myHeight; ++ky)
+            {
+                // Cells of the row with an odd x when one more odd coordinate is needed
+                const int needed = dim - (ky & 1) - (kz & 1);
+                if (needed < 0 || needed > 1)
+                    continue;
+                const uint64_t mask = needed == 1 ? 0xAAAAAAAAAAAAAAAAull : 0x5555555555555555ull;
+                const uint64_t *cells = row(ky, kz);
+                for (size_t k = 0; k < myWordsPerRow; ++k)
+                    total += static_cast<size_t>(__builtin_popcountll(cells[k] & mask));
+            }
+        }
+        return total;
+    }
+
+    // Function to list the cells of dimension dim, in raster order
+    std::vector<KhalimskyCell> getCells(int dim) const
+    {
+        std::vector<KhalimskyCell> cells;
+        cells.reserve(nbCells(dim));
+        forEachCell([&](const KhalimskyCell &cell)
+                    {
+                        if (cell.dim() == dim)
+                            cells.push_back(cell);
+                    });
+        return cells;
+    }
+
+    long long euler() const
+    {
+        return static_cast<long long>(nbCells(0)) - static_cast<long long>(nbCells(1)) +
+               static_cast<long long>(nbCells(2)) - static_cast<long long>(nbCells(3));
+    }
+
+    // Function to list the faces of dimension dim - 1 of a cell that are in the complex
+    std::vector<KhalimskyCell> cellBoundary(const KhalimskyCell &cell) const
+    {
+        std::vector<KhalimskyCell> faces;
+        forEachNeighbour(cell, true, [&](const KhalimskyCell &face)
+                         {
+                             if (contains(face))
+                                 faces.push_back(face);
+                         });
+        return faces;
+    }
+
+    // Function to list the cofaces of dimension dim + 1 of a cell that are in the complex
+    std::vector<KhalimskyCell> cellCoBoundary(const KhalimskyCell &cell) const
+    {
+        std::vector<KhalimskyCell> cofaces;
+        forEachNeighbour(cell, false, [&](const KhalimskyCell &coface)
+                         {
+                             if (contains(coface))
+                                 cofaces.push_back(coface);
+                         });
+        return cofaces;
+    }
+
+    // Function to call fn(cell) for every cell of the complex, in raster order
+    template <typename F>
+    void forEachCell(F &&fn) const
+    {
+        for (int kz = 0; kz < myDepth; ++kz)
+        {
+            for (int ky = 0; ky < myHeight; ++ky)
+            {
+                const uint64_t *cells = row(ky, kz);
+                for (size_t k = 0; k < myWordsPerRow; ++k)
+                {
+                    for (uint64_t bits = cells[k]; bits != 0; bits &= bits - 1)
+                        fn(KhalimskyCell{static_cast<int32_t>(k * 64) + __builtin_ctzll(bits), ky, kz});
+                }
+            }
+        }
+    }
+
+    // Function to collapse the complex by free pairs, keeping the cells for
+    // which isFixed(cell) is true; returns the number of cells removed
+    template <typename F>
+    size_t collapse(F &&isFixed, WorkStealingPool &pool)
+    {
+        // The free faces of the complex as it is, found slice by slice
+        std::vector<std::vector<KhalimskyCell>> freeFaces(static_cast<size_t>(myDepth));
+        pool.parallelFor(static_cast<size_t>(myDepth), [&](size_t kz, unsigned)
+        {
+            for (int ky = 0; ky < myHeight; ++ky)
+            {
+                const uint64_t *cells = row(ky, static_cast<int>(kz));
+                for (size_t k = 0; k < myWordsPerRow; ++k)
+                {
+                    for (uint64_t bits = cells[k]; bits != 0; bits &= bits - 1)
+                    {
+                        const KhalimskyCell cell{static_cast<int32_t>(k * 64) + __builtin_ctzll(bits), ky, static_cast<int>(kz)};
+                        if (countCofaces(cell) == 1)
+                            freeFaces[kz].push_back(cell);
+                    }
+                }
+            }
+        });
+
+        std::deque<KhalimskyCell> candidates;
+        for (const std::vector<KhalimskyCell> &slice : freeFaces)
+            candidates.insert(candidates.end(), slice.begin(), slice.end());
+        freeFaces.clear();
+
+        // Removing a pair changes the cofaces of the faces of both cells, and
+        // may make a face of the coface maximal: their faces are looked at again
+        size_t removed = 0;
+        while (!candidates.empty())
+        {
+            const KhalimskyCell face = candidates.front();
+            candidates.pop_front();
+            if (!contains(face) || isFixed(face))
+                continue;
+
+            KhalimskyCell coface{0, 0, 0};
+            if (countCofaces(face, &coface) != 1 || countCofaces(coface) != 0 || isFixed(coface))
+                continue;
+
+            eraseCell(face);
+            eraseCell(coface);
+            removed += 2;
+
+            forEachNeighbour(coface, true, [&](const KhalimskyCell &side)
+                             {
+                                 if (!contains(side))
+                                     return;
+                                 candidates.push_back(side);
+                                 forEachNeighbour(side, true, [&](const KhalimskyCell &subFace)
+                                                  {
+                                                      if (contains(subFace))
+                                                          candidates.push_back(subFace);
+                                                  });
+                             });
+            forEachNeighbour(face, true, [&](const KhalimskyCell &subFace)
+                             {
+                                 if (contains(subFace))
+                                     candidates.push_back(subFace);
+                             });
+        }
+        return removed;
+    }
+
+    // Function to collapse the complex by free pairs as far as possible
+    size_t collapse(WorkStealingPool &pool)
+    {
+        return collapse([](const KhalimskyCell &) { return false; }, pool);
+    }
+
+private:
+    const uint64_t *row(int ky, int kz) const { return myWords.data() + rowOffset(ky, kz); }
+    uint64_t *row(int ky, int kz) { return myWords.data() + rowOffset(ky, kz); }
+
+    size_t rowOffset(int ky, int kz) const
+    {
+        return (static_cast<size_t>(kz) * myHeight + static_cast<size_t>(ky)) * myWordsPerRow;
+    }
+
+    // Function to call fn on the faces (odd coordinates moved by one) or on the
+    // cofaces (even coordinates moved by one) of a cell, in or out of the complex
+    template <typename F>
+    void forEachNeighbour(const KhalimskyCell &cell, bool faces, F &&fn) const
+    {
+        const int32_t coordinates[3] = {cell.x, cell.y, cell.z};
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (((coordinates[axis] & 1) == 1) != faces)
+                continue;
+            for (int step = -1; step <= 1; step += 2)
+            {
+                KhalimskyCell neighbour = cell;
+                (axis == 0 ? neighbour.x : (axis == 1 ? neighbour.y : neighbour.z)) += step;
+                fn(neighbour);
+            }
+        }
+    }
+
+    // Function to count the cofaces of a cell in the complex, and to give the last one found
+    int countCofaces(const KhalimskyCell &cell, KhalimskyCell *last = nullptr) const
+    {
+        int count = 0;
+        forEachNeighbour(cell, false, [&](const KhalimskyCell &coface)
+                         {
+                             if (contains(coface))
+                             {
+                                 ++count;
+                                 if (last != nullptr)
+                                     *last = coface;
+                             }
+                         });
+        return count;
+    }
+
+    int myWidth = 0;
+    int myHeight = 0;
+    int myDepth = 0;
+    size_t myWordsPerRow = 0;
+    std::vector<uint64_t> myWords;
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+// Watch of a directory for new masks (Linux inotify).
+//
+// A file is reported once it is complete: when the process writing it closes
+// it (IN_CLOSE_WRITE), or when it is renamed into the directory (IN_MOVED_TO),
+// the usual way to publish a file atomically. Only names matching the fnmatch
+// pattern are reported, in the order the kernel delivers the events.
+//
+// next() blocks until a file arrives or stop() is called. stop() only writes
+// to an eventfd, so it may be called from a signal handler.
+//
+// The watch is armed before the directory is listed, so that no file is lost
+// in between; a file may then be both listed and reported. Every file handed
+// out, listed (claimListed) or reported (next), is remembered with its
+// modification time and size, and reported again only once it has changed.
+// A listed file still open for writing, or modified after the watch was
+// armed, may be incomplete: claimListed() leaves it to next(), which reports
+// it once closed. Open files are found with a read lease, which the kernel
+// refuses while a writer holds the file; where leases are not allowed (file
+// of another user, network file system), only the modification time is used.
+// A long-running watch calls forget() once it is done with a file, so that the
+// files handed out are not all kept: a forgotten file is reported again by a
+// new event only, when it is written or moved in again.
+// When the kernel queue overflows (IN_Q_OVERFLOW), events are lost: the
+// directory is listed again, and the files modified since the events were
+// last read, and not handed out yet, are reported.
+//
+// claimListed() and next() are not thread-safe; callers serialize them.
+// forget() may be called from any thread, even while next() waits.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+class DirectoryWatcher
+{
+public:
+    DirectoryWatcher(const std::string &directory, const std::string &pattern)
+        : myDirectory(directory), myPattern(pattern)
+    {
+        myInotifyFd = ::inotify_init1(IN_CLOEXEC);
+        if (myInotifyFd < 0)
+            throw std::runtime_error("inotify: " + std::string(std::strerror(errno)));
+        if (::inotify_add_watch(myInotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        {
+            const std::string reason = std::strerror(errno);
+            ::close(myInotifyFd);
+            throw std::runtime_error("cannot watch " + directory + ": " + reason);
+        }
+        myStopFd = ::eventfd(0, EFD_CLOEXEC);
+        if (myStopFd < 0)
+        {
+            ::close(myInotifyFd);
+            throw std::runtime_error("eventfd: " + std::string(std::strerror(errno)));
+        }
+        // After the watch is added, from the coarse clock the file times come from
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &myArmedAt);
+        myReadAt = myArmedAt;
+    }
+
+    ~DirectoryWatcher()
+    {
+        ::close(myInotifyFd);
+        ::close(myStopFd);
+    }
+
+    DirectoryWatcher(const DirectoryWatcher &) = delete;
+    DirectoryWatcher &operator=(const DirectoryWatcher &) = delete;
+
+    // Function to claim a file of the initial listing; false when it is left
+    // to next(), having changed after the watch was armed, or already claimed
+    bool claimListed(const std::string &fileName)
+    {
+        FileStamp stamp;
+        if (!stampOf(fileName, stamp))
+            return false;
+        if (stamp.seconds > myArmedAt.tv_sec ||
+            (stamp.seconds == myArmedAt.tv_sec && stamp.nanoseconds > myArmedAt.tv_nsec))
+            return false;
+        if (isOpenForWriting(fileName))
+            return false;
+        return claim(fileName, stamp);
+    }
+
+    // Function to wait for the next complete file; returns false once stopped
+    bool next(std::string &fileName)
+    {
+        for (;;)
+        {
+            while (!myReady.empty())
+            {
+                fileName = myReady.front();
+                myReady.pop_front();
+                FileStamp stamp;
+                if (stampOf(fileName, stamp) && claim(fileName, stamp))
+                    return true;
+            }
+            if (!waitForEvents())
+                return false;
+        }
+    }
+
+    // Function to drop a file handed out, once it is processed
+    void forget(const std::string &fileName)
+    {
+        std::lock_guard<std::mutex> guard(myClaimedMutex);
+        myClaimed.erase(fileName);
+    }
+
+    // Function to make next() return false, now and from then on
+    void stop()
+    {
+        const uint64_t one = 1;
+        ssize_t written = ::write(myStopFd, &one, sizeof(one));
+        (void)written;
+    }
+
+private:
+    // What tells two versions of a file apart
+    struct FileStamp
+    {
+        long long seconds = 0;
+        long nanoseconds = 0;
+        long long size = 0;
+
+        bool operator==(const FileStamp &other) const
+        {
+            return seconds == other.seconds && nanoseconds == other.nanoseconds && size == other.size;
+        }
+    };
+
+    static bool stampOf(const std::string &fileName, FileStamp &stamp)
+    {
+        struct stat status;
+        if (::stat(fileName.c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+            return false;
+        stamp.seconds = static_cast<long long>(status.st_mtim.tv_sec);
+        stamp.nanoseconds = status.st_mtim.tv_nsec;
+        stamp.size = static_cast<long long>(status.st_size);
+        return true;
+    }
+
+    // Function to tell whether a process holds a file open for writing; false
+    // when a read lease cannot tell
+    static bool isOpenForWriting(const std::string &fileName)
+    {
+        const int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        const bool busy = ::fcntl(fd, F_SETLEASE, F_RDLCK) < 0 && errno == EAGAIN;
+        if (!busy)
+            ::fcntl(fd, F_SETLEASE, F_UNLCK);
+        ::close(fd);
+        return busy;
+    }
+
+    // Function to remember a file as handed out; false when it was already, unchanged
+    bool claim(const std::string &fileName, const FileStamp &stamp)
+    {
+        std::lock_guard<std::mutex> guard(myClaimedMutex);
+        auto it = myClaimed.find(fileName);
+        if (it != myClaimed.end() && it->second == stamp)
+            return false;
+        myClaimed[fileName] = stamp;
+        return true;
+    }
+
+    // Function to wait for events and queue their files; false once stopped
+    bool waitForEvents()
+    {
+        while (myReady.empty())
+        {
+            if (myStopped)
+                return false;
+
+            pollfd fds[2] = {{myInotifyFd, POLLIN, 0}, {myStopFd, POLLIN, 0}};
+            if (::poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error("poll: " + std::string(std::strerror(errno)));
+            }
+            if (fds[1].revents & POLLIN)
+            {
+                myStopped = true;
+                return false;
+            }
+            if (fds[0].revents & POLLIN)
+                readEvents();
+        }
+        return true;
+    }
+
+    void readEvents()
+    {
+        // Large enough for many events at once, aligned for inotify_event
+        alignas(inotify_event) char buffer[1 << 14];
+        timespec readAt{};
+        ::clock_gettime(CLOCK_REALTIME_COARSE, &readAt);
+        const ssize_t length = ::read(myInotifyFd, buffer, sizeof(buffer));
+        if (length < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                return;
+            throw std::runtime_error("inotify: " + std::string(std::strerror(errno)));
+        }
+        for (ssize_t offset = 0; offset < length;)
+        {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                rescan();
+                continue;
+            }
+            if (event->len == 0 || (event->mask & IN_ISDIR))
+                continue;
+            if (fnmatch(myPattern.c_str(), event->name, 0) == 0)
+                myReady.push_back((std::filesystem::path(myDirectory) / event->name).string());
+        }
+        // The events lost in a later overflow come after this read
+        myReadAt = readAt;
+    }
+
+    // Function to queue the matching files of the directory modified since the
+    // events were last read, after lost events
+    void rescan()
+    {
+        std::vector<std::string> fileNames;
+        std::error_code error;
+        for (const auto &entry : std::filesystem::directory_iterator(myDirectory, error))
+        {
+            if (fnmatch(myPattern.c_str(), entry.path().filename().string().c_str(), 0) != 0)
+                continue;
+            FileStamp stamp;
+            if (stampOf(entry.path().string(), stamp) &&
+                (stamp.seconds > myReadAt.tv_sec ||
+                 (stamp.seconds == myReadAt.tv_sec && stamp.nanoseconds >= myReadAt.tv_nsec)))
+                fileNames.push_back(entry.path().string());
+        }
+        std::sort(fileNames.begin(), fileNames.end());
+        myReady.insert(myReady.end(), fileNames.begin(), fileNames.end());
+    }
+
+    std::string myDirectory;
+    std::string myPattern;
+    int myInotifyFd = -1;
+    int myStopFd = -1;
+    bool myStopped = false;
+    std::deque<std::string> myReady;
+    std::mutex myClaimedMutex;
+    std::map<std::string, FileStamp> myClaimed; // Files handed out and not forgotten, with their version
+    timespec myArmedAt{};
+    timespec myReadAt{}; // When the events were last read
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+// Euler characteristic of a binary volume from its 2x2x2 configurations.
+//
+// χ is additive over the cells of the complex of the object, and every cell
+// can be split among the 2x2x2 windows of voxels that contain it. The sum of
+// the shares of one window only depends on which of its 8 voxels are set, so
+// χ is the sum, over all the windows of the volume padded with background, of
+// a value read in a 256-entry table. The tables hold 8 times these values, so
+// they are integers, and are built at compile time for both conventions:
+//
+//  - 26/6 (DGtal DT26_6): the object is the union of its closed unit cubes,
+//    as in CubicalComplex::construct(). Windows are centered on the lattice
+//    points: the point itself, its 6 half-edges, its 12 quarter-faces and the
+//    8 octants of the cubes around it.
+//  - 6/26 (DGtal DT6_26): the voxels are the vertices of the complex, with
+//    an edge between 6-adjacent voxels, a square for 2x2 voxels and a cube
+//    for 2x2x2 voxels, each counted 1/8, 1/4, 1/2 and 1 time per window.
+//
+// eulerCharacteristic() streams once over the rows of the volume, 64 windows
+// per word, skips the empty words, and stores no cell at all.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "BitVolume.h"
+
+// Adjacencies of the foreground and of the background
+enum VoxelTopology
+{
+    TOPOLOGY_26_6,
+    TOPOLOGY_6_26
+};
+
+// Function to build the table of 8 times the share of χ of each 2x2x2
+// configuration; bit (dx + 2 dy + 4 dz) of a configuration is the voxel at
+// offset (dx, dy, dz) in the window
+constexpr std::array<int, 256> makeEulerTable(VoxelTopology topology)
+{
+    std::array<int, 256> table{};
+    for (int config = 0; config < 256; ++config)
+    {
+        // Voxel at coordinate a along the axis and (p, q) along the two others
+        auto voxel = [config](int x, int y, int z) { return (config >> (x + 2 * y + 4 * z)) & 1; };
+        auto at = [&voxel](int axis, int a, int p, int q)
+        {
+            return axis == 0 ? voxel(a, p, q) : (axis == 1 ? voxel(p, a, q) : voxel(p, q, a));
+        };
+
+        int voxels = 0;
+        for (int i = 0; i < 8; ++i)
+            voxels += (config >> i) & 1;
+
+        int value = 0;
+        if (topology == TOPOLOGY_26_6)
+        {
+            // Closed cubes: a cell is in the complex when any voxel around it is set
+            value += config != 0 ? 8 : 0;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int a = 0; a < 2; ++a)
+                {
+                    // Half-edge from the center along the axis, towards side a
+                    if (at(axis, a, 0, 0) | at(axis, a, 1, 0) | at(axis, a, 0, 1) | at(axis, a, 1, 1))
+                        value -= 4;
+                }
+                for (int p = 0; p < 2; ++p)
+                {
+                    for (int q = 0; q < 2; ++q)
+                    {
+                        // Quarter of the face normal to the axis, in quadrant (p, q)
+                        if (at(axis, 0, p, q) | at(axis, 1, p, q))
+                            value += 2;
+                    }
+                }
+            }
+            value -= voxels;
+        }
+        else
+        {
+            // Voxels as vertices: a cell is in the complex when all its voxels are set
+            value += voxels;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                for (int p = 0; p < 2; ++p)
+                {
+                    for (int q = 0; q < 2; ++q)
+                    {
+                        // Edge between the two voxels along the axis
+                        if (at(axis, 0, p, q) & at(axis, 1, p, q))
+                            value -= 2;
+                    }
+                }
+                for (int a = 0; a < 2; ++a)
+                {
+                    // Square of the 4 voxels normal to the axis, on side a
+                    if (at(axis, a, 0, 0) & at(axis, a, 1, 0) & at(axis, a, 0, 1) & at(axis, a, 1, 1))
+                        value += 4;
+                }
+            }
+            value -= config == 255 ? 8 : 0;
+        }
+        table[config] = value;
+    }
+    return table;
+}
+
+constexpr std::array<int, 256> EULER_TABLE_26_6 = makeEulerTable(TOPOLOGY_26_6);
+constexpr std::array<int, 256> EULER_TABLE_6_26 = makeEulerTable(TOPOLOGY_6_26);
+
+// A single voxel is a ball, a full window is inside the object
+static_assert(EULER_TABLE_26_6[0] == 0 && EULER_TABLE_26_6[1] == 1 && EULER_TABLE_26_6[255] == 0, "26/6 table");
+static_assert(EULER_TABLE_6_26[0] == 0 && EULER_TABLE_6_26[1] == 1 && EULER_TABLE_6_26[255] == 0, "6/26 table");
+
+// Function to compute the Euler characteristic of the foreground of a volume
+inline long long eulerCharacteristic(const BitVolume &volume, VoxelTopology topology)
+{
+    const std::array<int, 256> &table = topology == TOPOLOGY_26_6 ? EULER_TABLE_26_6 : EULER_TABLE_6_26;
+    const size_t words = volume.wordsPerRow();
+    long long sum = 0;
+
+    // Window (x, y, z) covers the voxels [x, x + 1] x [y, y + 1] x [z, z + 1],
+    // from -1 to the size minus one along each axis
+    for (int z = -1; z < volume.depth(); ++z)
+    {
+        for (int y = -1; y < volume.height(); ++y)
+        {
+            // Rows dy + 2 dz of the window; nullptr outside the volume
+            const uint64_t *rows[4];
+            bool any = false;
+            for (int r = 0; r < 4; ++r)
+            {
+                const int ry = y + (r & 1);
+                const int rz = z + (r >> 1);
+                const bool inside = ry >= 0 && rz >= 0 && ry < volume.height() && rz < volume.depth();
+                rows[r] = inside ? volume.row(ry, rz) : nullptr;
+                any = any || inside;
+            }
+            if (!any)
+                continue;
+
+            // Word k gives the windows x = 64 k - 1 .. 64 k + 62: the low voxel of
+            // window 64 k + j - 1 is bit j of (word << 1 | top bit of the previous
+            // word), its high voxel bit j of the word. One more, empty word
+            // closes the last window.
+            uint64_t previous[4] = {0, 0, 0, 0};
+            for (size_t k = 0; k <= words; ++k)
+            {
+                uint64_t low[4], high[4];
+                uint64_t occupied = 0;
+                for (int r = 0; r < 4; ++r)
+                {
+                    high[r] = rows[r] != nullptr && k < words ? rows[r][k] : 0;
+                    low[r] = (high[r] << 1) | (previous[r] >> 63);
+                    previous[r] = high[r];
+                    occupied |= low[r] | high[r];
+                }
+                while (occupied != 0)
+                {
+                    const int j = __builtin_ctzll(occupied);
+                    occupied &= occupied - 1;
+                    int config = 0;
+                    for (int r = 0; r < 4; ++r)
+                        config |= static_cast<int>(((low[r] >> j) & 1) | (((high[r] >> j) & 1) << 1)) << (2 * r);
+                    sum += table[config];
+                }
+            }
+        }
+    }
+    return sum / 8;
+}
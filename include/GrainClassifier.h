@@ -0,0 +1,245 @@
+#pragma once
+
+// Classification of grains from their measurements (STEP 8 and STEP 9).
+//
+// GrainFeatureTable stores one feature vector per grain in a structure of
+// arrays: one contiguous float column per feature, so the distance kernels
+// stream through memory and vectorize (SSE2 when available, four grains per
+// instruction). Features are standardized with the mean and the standard
+// deviation of the training set before any distance is taken.
+//
+// GrainClassifier either keeps one centroid per class (nearest centroid), or
+// the whole standardized training set (k nearest neighbours, majority vote).
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "GrainMeasurement.h"
+
+// Function to add (column[i] - value)^2 to distances[i] for i in [0, n)
+inline void addSquaredDifferences(const float *column, float value, float *distances, size_t n)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 v = _mm_set1_ps(value);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(column + i), v);
+        _mm_storeu_ps(distances + i, _mm_add_ps(_mm_loadu_ps(distances + i), _mm_mul_ps(d, d)));
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        const float d = column[i] - value;
+        distances[i] += d * d;
+    }
+}
+
+// Feature vectors of a set of grains, one column per feature
+class GrainFeatureTable
+{
+public:
+    enum Feature
+    {
+        AREA,
+        PERIMETER, // DSS length when it was estimated, polygon perimeter otherwise
+        CIRCULARITY,
+        ELONGATION,
+        ECCENTRICITY,
+        FEATURES
+    };
+
+    static const char *featureName(size_t feature)
+    {
+        static const char *names[FEATURES] = {"area", "perimeter", "circularity", "elongation", "eccentricity"};
+        return names[feature];
+    }
+
+    // Function to add the features of one grain; classId is -1 when unknown
+    void append(const GrainMeasurement &measurement, int classId = -1)
+    {
+        const double perimeter = measurement.perimeter_dss > 0.0 ? measurement.perimeter_dss
+                                                                  : measurement.perimeter_polygon;
+        const double circularity = perimeter > 0.0 ? 4.0 * M_PI * measurement.area_polygon / (perimeter * perimeter)
+                                                   : 0.0;
+        myColumns[AREA].push_back(static_cast<float>(measurement.area_2cells));
+        myColumns[PERIMETER].push_back(static_cast<float>(perimeter));
+        myColumns[CIRCULARITY].push_back(static_cast<float>(circularity));
+        myColumns[ELONGATION].push_back(static_cast<float>(measurement.moments.elongation));
+        myColumns[ECCENTRICITY].push_back(static_cast<float>(measurement.moments.eccentricity));
+        myClasses.push_back(classId);
+    }
+
+    size_t size() const { return myClasses.size(); }
+    const float *column(size_t feature) const { return myColumns[feature].data(); }
+    float value(size_t feature, size_t i) const { return myColumns[feature][i]; }
+    int classOf(size_t i) const { return myClasses[i]; }
+
+private:
+    std::vector<float> myColumns[FEATURES];
+    std::vector<int> myClasses;
+};
+
+class GrainClassifier
+{
+public:
+    enum Method
+    {
+        NEAREST_CENTROID,
+        KNN
+    };
+
+    explicit GrainClassifier(Method method = NEAREST_CENTROID, int k = 5) : myMethod(method), myK(std::max(1, k)) {}
+
+    Method method() const { return myMethod; }
+    size_t classes() const { return myClassNames.size(); }
+    const std::string &className(int classId) const { return myClassNames[classId]; }
+    bool trained() const { return myTrainingSize > 0; }
+
+    // Function to learn from a table whose grains all have a class in [0, classNames.size())
+    void train(const GrainFeatureTable &table, const std::vector<std::string> &classNames)
+    {
+        myClassNames = classNames;
+        myTrainingSize = table.size();
+        const size_t n = table.size();
+        const size_t c = classNames.size();
+
+        // Standardization of every feature over the training set
+        for (size_t f = 0; f < GrainFeatureTable::FEATURES; ++f)
+        {
+            double sum = 0.0, sumSquares = 0.0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                sum += table.value(f, i);
+                sumSquares += static_cast<double>(table.value(f, i)) * table.value(f, i);
+            }
+            const double mean = n > 0 ? sum / n : 0.0;
+            const double variance = n > 0 ? std::max(0.0, sumSquares / n - mean * mean) : 0.0;
+            myMean[f] = static_cast<float>(mean);
+            myInverseScale[f] = variance > 0.0 ? static_cast<float>(1.0 / std::sqrt(variance)) : 1.0f;
+            standardize(table, f, myTraining[f]);
+        }
+        myTrainingClasses.resize(n);
+        for (size_t i = 0; i < n; ++i)
+            myTrainingClasses[i] = table.classOf(i);
+
+        // One centroid per class, in the standardized space
+        std::vector<size_t> counts(c, 0);
+        for (size_t i = 0; i < n; ++i)
+            counts[myTrainingClasses[i]]++;
+        for (size_t f = 0; f < GrainFeatureTable::FEATURES; ++f)
+        {
+            myCentroids[f].assign(c, 0.0f);
+            for (size_t i = 0; i < n; ++i)
+                myCentroids[f][myTrainingClasses[i]] += myTraining[f][i];
+            for (size_t k = 0; k < c; ++k)
+                myCentroids[f][k] = counts[k] > 0 ? myCentroids[f][k] / counts[k] : 0.0f;
+        }
+    }
+
+    // Function to classify every grain of a table; returns one class id per grain
+    std::vector<int> classify(const GrainFeatureTable &grains) const
+    {
+        const size_t n = grains.size();
+        std::vector<int> result(n, -1);
+        if (n == 0 || !trained())
+            return result;
+
+        std::vector<float> columns[GrainFeatureTable::FEATURES];
+        for (size_t f = 0; f < GrainFeatureTable::FEATURES; ++f)
+            standardize(grains, f, columns[f]);
+
+        if (myMethod == NEAREST_CENTROID)
+        {
+            // Distances of all the grains to one centroid at a time
+            std::vector<float> best(n, 0.0f);
+            std::vector<float> distances(n);
+            for (size_t k = 0; k < classes(); ++k)
+            {
+                std::fill(distances.begin(), distances.end(), 0.0f);
+                for (size_t f = 0; f < GrainFeatureTable::FEATURES; ++f)
+                    addSquaredDifferences(columns[f].data(), myCentroids[f][k], distances.data(), n);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    if (k == 0 || distances[i] < best[i])
+                    {
+                        best[i] = distances[i];
+                        result[i] = static_cast<int>(k);
+                    }
+                }
+            }
+            return result;
+        }
+
+        // Distances of one grain to all the training grains at a time
+        const size_t m = myTrainingSize;
+        const size_t k = std::min(static_cast<size_t>(myK), m);
+        std::vector<float> distances(m);
+        std::vector<size_t> order(m);
+        std::vector<size_t> votes(classes());
+        std::vector<size_t> nearest(classes()); // Nearest neighbour of each class among the k
+        for (size_t i = 0; i < n; ++i)
+        {
+            std::fill(distances.begin(), distances.end(), 0.0f);
+            for (size_t f = 0; f < GrainFeatureTable::FEATURES; ++f)
+                addSquaredDifferences(myTraining[f].data(), columns[f][i], distances.data(), m);
+
+            // Training grains by distance, then by index
+            auto closer = [&](size_t a, size_t b)
+            { return distances[a] < distances[b] || (distances[a] == distances[b] && a < b); };
+            for (size_t j = 0; j < m; ++j)
+                order[j] = j;
+            std::nth_element(order.begin(), order.begin() + (k - 1), order.end(), closer);
+
+            // Majority vote; ties go to the tied class with the nearest neighbour
+            std::fill(votes.begin(), votes.end(), 0);
+            for (size_t j = 0; j < k; ++j)
+            {
+                const int c = myTrainingClasses[order[j]];
+                if (votes[c]++ == 0 || closer(order[j], nearest[c]))
+                    nearest[c] = order[j];
+            }
+            int winner = -1;
+            for (size_t c = 0; c < classes(); ++c)
+            {
+                if (votes[c] == 0)
+                    continue;
+                if (winner < 0 || votes[c] > votes[winner] ||
+                    (votes[c] == votes[winner] && closer(nearest[c], nearest[winner])))
+                    winner = static_cast<int>(c);
+            }
+            result[i] = winner;
+        }
+        return result;
+    }
+
+private:
+    // Function to write the standardized column of a feature
+    void standardize(const GrainFeatureTable &table, size_t feature, std::vector<float> &out) const
+    {
+        const size_t n = table.size();
+        const float *in = table.column(feature);
+        const float mean = myMean[feature];
+        const float scale = myInverseScale[feature];
+        out.resize(n);
+        for (size_t i = 0; i < n; ++i)
+            out[i] = (in[i] - mean) * scale;
+    }
+
+    Method myMethod;
+    int myK;
+    std::vector<std::string> myClassNames;
+    size_t myTrainingSize = 0;
+    float myMean[GrainFeatureTable::FEATURES] = {};
+    float myInverseScale[GrainFeatureTable::FEATURES] = {};
+    std::vector<float> myTraining[GrainFeatureTable::FEATURES];  // Standardized training columns
+    std::vector<int> myTrainingClasses;
+    std::vector<float> myCentroids[GrainFeatureTable::FEATURES]; // myCentroids[feature][class]
+};
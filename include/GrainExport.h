@@ -0,0 +1,303 @@
+#pragma once
+
+// Per-grain export of the measurements, in a columnar binary format or CSV.
+//
+// Binary layout (host byte order, checked with the byte order mark):
+//
+//   header     "GRAINCOL" | u32 version = 1 | u32 byte order mark 0x01020304
+//              | u32 column count | for each column: u8 type, u16 name length, name
+//   row group  u32 file id | u16 file name length, file name | u64 rows
+//              | for each column: rows values, contiguous
+//   end        u32 0xffffffff
+//
+// Types: 0 = int32, 1 = uint32, 2 = float64. One row group is written per
+// input file, from a buffered stream, so the writer holds one file's grains
+// at most and readers can load a single column without parsing the others.
+//
+// Every row group is flushed once written. The end marker is written by
+// close() only, once every row group made it to the file. An exporter that failed, or is destroyed without close(), cuts
+// its files back to the last complete row group (CSV: to the last complete
+// file) and writes no end marker, so a reader can tell the file is incomplete.
+// Files whose names are longer than 65535 bytes do not fit the u16 length and
+// are left out; in CSV, names with a comma, a quote or a line break are quoted.
+// perimeter_dss is NaN ("nan" in CSV) for a grain whose DSS decomposition failed.
+
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ContourTracing.h"
+#include "GrainMeasurement.h"
+
+// Grains of one file to export; classes may be empty (not classified)
+struct GrainExportRows
+{
+    uint32_t fileId = 0;
+    std::string fileName;
+    const std::vector<TracedContour<DGtal::Z2i::Point>> *contours = nullptr;
+    const std::vector<GrainMeasurement> *measurements = nullptr;
+    const std::vector<int> *classes = nullptr;
+};
+
+class GrainExporter
+{
+public:
+    enum ColumnType : uint8_t
+    {
+        INT32 = 0,
+        UINT32 = 1,
+        FLOAT64 = 2
+    };
+
+    // Function to open the outputs; an empty name skips that output
+    GrainExporter(const std::string &binaryName, const std::string &csvName)
+        : myBinaryName(binaryName), myCsvName(csvName), myBinary(nullptr, &std::fclose), myCsv(nullptr, &std::fclose)
+    {
+        if (!binaryName.empty())
+        {
+            myBinary.reset(std::fopen(binaryName.c_str(), "wb"));
+            if (!myBinary)
+                throw std::runtime_error("cannot write " + binaryName);
+            std::setvbuf(myBinary.get(), nullptr, _IOFBF, 1 << 20);
+            writeHeader();
+        }
+        if (!csvName.empty())
+        {
+            myCsv.reset(std::fopen(csvName.c_str(), "w"));
+            if (!myCsv)
+                throw std::runtime_error("cannot write " + csvName);
+            std::setvbuf(myCsv.get(), nullptr, _IOFBF, 1 << 20);
+            std::fprintf(myCsv.get(), "file");
+            for (const Column &column : columns())
+                std::fprintf(myCsv.get(), ",%s", column.name);
+            std::fprintf(myCsv.get(), "\n");
+        }
+        commit();
+    }
+
+    ~GrainExporter()
+    {
+        if (isOpen())
+            abandon();
+    }
+
+    GrainExporter(const GrainExporter &) = delete;
+    GrainExporter &operator=(const GrainExporter &) = delete;
+
+    // Function to tell whether rows can still be written
+    bool isOpen() const { return myBinary || myCsv; }
+
+    // Function to write the grains of one file; throws std::runtime_error when
+    // it cannot. A refused file name leaves the exporter open; a failed write
+    // abandons it, cut back to the files written before.
+    void write(const GrainExportRows &rows)
+    {
+        if (!isOpen())
+            throw std::runtime_error("the export is closed");
+        if (rows.fileName.size() > std::numeric_limits<uint16_t>::max())
+            throw std::runtime_error("file name too long for the export: " + rows.fileName.substr(0, 64) + "...");
+        try
+        {
+            writeRows(rows);
+            commit();
+        }
+        catch (...)
+        {
+            abandon();
+            throw;
+        }
+    }
+
+    // Function to write the end marker and close the files; throws
+    // std::runtime_error when the data did not all reach them
+    void close()
+    {
+        bool failed = false;
+        if (myBinary)
+        {
+            const uint32_t end = 0xffffffffu;
+            failed = std::fwrite(&end, sizeof(end), 1, myBinary.get()) != 1;
+            failed = std::fclose(myBinary.release()) != 0 || failed;
+        }
+        if (myCsv)
+            failed = std::fclose(myCsv.release()) != 0 || failed;
+        if (failed)
+        {
+            cutBack();
+            throw std::runtime_error("cannot write the export");
+        }
+    }
+
+private:
+    // Function to write the rows of one file, without committing them
+    void writeRows(const GrainExportRows &rows)
+    {
+        const size_t n = rows.measurements->size();
+        if (myBinary)
+        {
+            std::FILE *out = myBinary.get();
+            writeValue(out, rows.fileId);
+            writeString(out, rows.fileName);
+            writeValue(out, static_cast<uint64_t>(n));
+            for (const Column &column : columns())
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    const double value = column.get(rows, i);
+                    if (column.type == INT32)
+                        writeValue(out, static_cast<int32_t>(value));
+                    else if (column.type == UINT32)
+                        writeValue(out, static_cast<uint32_t>(value));
+                    else
+                        writeValue(out, value);
+                }
+            }
+            if (std::ferror(out))
+                throw std::runtime_error("cannot write the binary export");
+        }
+        if (myCsv)
+        {
+            std::FILE *out = myCsv.get();
+            for (size_t i = 0; i < n; ++i)
+            {
+                writeCsvField(out, rows.fileName);
+                for (const Column &column : columns())
+                {
+                    const double value = column.get(rows, i);
+                    if (column.type == FLOAT64)
+                        std::fprintf(out, ",%.17g", value);
+                    else
+                        std::fprintf(out, ",%lld", static_cast<long long>(value));
+                }
+                std::fprintf(out, "\n");
+            }
+            if (std::ferror(out))
+                throw std::runtime_error("cannot write the CSV export");
+        }
+    }
+
+    // Function to flush the files and record their ends as complete; once per
+    // input file, so the buffer still gathers the many small writes of a file
+    void commit()
+    {
+        if (myBinary && std::fflush(myBinary.get()) != 0)
+            throw std::runtime_error("cannot write the binary export");
+        if (myCsv && std::fflush(myCsv.get()) != 0)
+            throw std::runtime_error("cannot write the CSV export");
+        if (myBinary)
+            myBinaryEnd = std::ftell(myBinary.get());
+        if (myCsv)
+            myCsvEnd = std::ftell(myCsv.get());
+    }
+
+    // Function to close the files without end marker, cut back to the last commit
+    void abandon()
+    {
+        if (myBinary)
+            std::fclose(myBinary.release());
+        if (myCsv)
+            std::fclose(myCsv.release());
+        cutBack();
+    }
+
+    // Function to cut the closed files back to their last complete row group
+    void cutBack()
+    {
+        if (!myBinaryName.empty() && myBinaryEnd >= 0)
+            (void)::truncate(myBinaryName.c_str(), static_cast<off_t>(myBinaryEnd));
+        if (!myCsvName.empty() && myCsvEnd >= 0)
+            (void)::truncate(myCsvName.c_str(), static_cast<off_t>(myCsvEnd));
+    }
+
+    struct Column
+    {
+        const char *name;
+        ColumnType type;
+        double (*get)(const GrainExportRows &, size_t);
+    };
+
+    // Schema: every column with the way to read it for grain i
+    static const std::vector<Column> &columns()
+    {
+        static const std::vector<Column> schema = {
+            {"file_id", UINT32, [](const GrainExportRows &r, size_t) { return double(r.fileId); }},
+            {"label", UINT32, [](const GrainExportRows &r, size_t i) { return double((*r.contours)[i].label); }},
+            {"min_x", INT32, [](const GrainExportRows &r, size_t i) { return double((*r.measurements)[i].moments.minX); }},
+            {"min_y", INT32, [](const GrainExportRows &r, size_t i) { return double((*r.measurements)[i].moments.minY); }},
+            {"max_x", INT32, [](const GrainExportRows &r, size_t i) { return double((*r.measurements)[i].moments.maxX); }},
+            {"max_y", INT32, [](const GrainExportRows &r, size_t i) { return double((*r.measurements)[i].moments.maxY); }},
+            {"area_2cells", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].area_2cells; }},
+            {"area_polygon", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].area_polygon; }},
+            {"perimeter_boundary", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].perimeter_boundary; }},
+            {"perimeter_polygon", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].perimeter_polygon; }},
+            {"perimeter_dss", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].perimeter_dss; }},
+            {"circularity", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].circularity; }},
+            {"centroid_x", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].moments.centroidX; }},
+            {"centroid_y", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].moments.centroidY; }},
+            {"orientation", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].moments.orientation; }},
+            {"elongation", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].moments.elongation; }},
+            {"eccentricity", FLOAT64, [](const GrainExportRows &r, size_t i) { return (*r.measurements)[i].moments.eccentricity; }},
+            {"class", INT32, [](const GrainExportRows &r, size_t i)
+             { return r.classes != nullptr && i < r.classes->size() ? double((*r.classes)[i]) : -1.0; }},
+        };
+        return schema;
+    }
+
+    template <typename T>
+    static void writeValue(std::FILE *out, const T &value)
+    {
+        std::fwrite(&value, sizeof(T), 1, out);
+    }
+
+    // Function to write a CSV field, quoted when it holds a separator
+    static void writeCsvField(std::FILE *out, const std::string &text)
+    {
+        if (text.find_first_of(",\"\r\n") == std::string::npos)
+        {
+            std::fputs(text.c_str(), out);
+            return;
+        }
+        std::fputc('"', out);
+        for (char c : text)
+        {
+            if (c == '"')
+                std::fputc('"', out);
+            std::fputc(c, out);
+        }
+        std::fputc('"', out);
+    }
+
+    // Function to write a string with its u16 length; callers check the length
+    static void writeString(std::FILE *out, const std::string &text)
+    {
+        writeValue(out, static_cast<uint16_t>(text.size()));
+        std::fwrite(text.data(), 1, text.size(), out);
+    }
+
+    void writeHeader()
+    {
+        std::FILE *out = myBinary.get();
+        std::fwrite("GRAINCOL", 1, 8, out);
+        writeValue(out, uint32_t(1));
+        writeValue(out, uint32_t(0x01020304));
+        writeValue(out, static_cast<uint32_t>(columns().size()));
+        for (const Column &column : columns())
+        {
+            writeValue(out, static_cast<uint8_t>(column.type));
+            writeString(out, column.name);
+        }
+    }
+
+    std::string myBinaryName;
+    std::string myCsvName;
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> myBinary;
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> myCsv;
+    long myBinaryEnd = -1; // Ends of the files after the last complete row group
+    long myCsvEnd = -1;
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+// Measurements of one grain from its boundary chain, shared by TP1-2 and the
+// estimator benchmarks: area (2-cells, polygon), perimeter (1-cells, polygon,
+// greedy DSS length), circularity and the moments of the polygon.
+
+#include <cmath>
+#include <exception>
+#include <limits>
+#include <string>
+
+#include <DGtal/helpers/StdDefs.h>
+#include <DGtal/geometry/curves/ArithmeticalDSSComputer.h>
+#include <DGtal/geometry/curves/GreedySegmentation.h>
+
+#include "ContourMoments.h"
+#include "PackedFreemanChain.h"
+#include "RunLengthLabeling.h"
+
+typedef PackedFreemanChain<DGtal::Z2i::Point> Contour4; // Boundary of a grain
+typedef DGtal::ArithmeticalDSSComputer<Contour4::ConstIterator, int, 4> DSS4;
+typedef DGtal::GreedySegmentation<DSS4> Decomposition4;
+
+// Perimeter estimators to compute and report
+struct PerimeterEstimators
+{
+    bool cells = true;   // Number of boundary 1-cells
+    bool polygon = true; // Length of the polygon through the chain points
+    bool dss = false;    // Length of the greedy decomposition into digital straight segments
+};
+
+// Function to estimate the length of a closed chain from its greedy DSS
+// decomposition: each segment is replaced by the straight line between its
+// end points. Every point is added to at most two segments, so this is
+// linear in the length of the chain, and it converges to the length of the
+// continuous boundary as the grid gets finer, unlike the unit steps count.
+inline double estimateDSSLength(const Contour4 &theContour)
+{
+    double length = 0.0;
+    Decomposition4 theDecomposition(theContour.begin(), theContour.end(), DSS4());
+    for (auto itSeg = theDecomposition.begin(); itSeg != theDecomposition.end(); ++itSeg)
+    {
+        const DGtal::Z2i::Point first = itSeg->back();
+        const DGtal::Z2i::Point last = itSeg->front();
+        length += std::hypot(static_cast<double>(last[0] - first[0]), static_cast<double>(last[1] - first[1]));
+    }
+    return length;
+}
+
+// Measurements of one grain (STEP 5 to STEP 7)
+struct GrainMeasurement
+{
+    double area_2cells = 0.0;
+    double area_polygon = 0.0;
+    double perimeter_boundary = 0.0;
+    double perimeter_polygon = 0.0;
+    double perimeter_dss = 0.0; // NaN when the DSS decomposition failed; the other measures stand
+    double circularity = 0.0;
+    ContourMoments moments; // Centroid, bounding box and second order descriptors of the polygon
+    std::string error;      // Non-empty when the grain could not be measured at all
+};
+
+// Function to measure one grain from its boundary chain, in a single walk along
+// it (and a second one for the DSS length when that estimator is selected)
+inline GrainMeasurement measureGrain(const Contour4 &theContour, const GrainRecord &record,
+                              const PerimeterEstimators &estimators)
+{
+    GrainMeasurement measurement;
+    measurement.area_2cells = static_cast<double>(record.pixelCount);
+
+    // Every step of the chain crosses one boundary 1-cell
+    measurement.perimeter_boundary = static_cast<double>(theContour.size());
+
+    if (theContour.empty())
+    {
+        measurement.error = "Boundary is empty for a component. Skipping area and perimeter calculation.";
+        return measurement;
+    }
+
+    // Area, perimeter and moments of the polygon through the chain points
+    measurement.moments = computeContourMoments(theContour);
+    measurement.area_polygon = measurement.moments.area;
+    measurement.perimeter_polygon = measurement.moments.perimeter;
+
+    // STEP 7: Calculate circularity
+    // Circularity = (4 * π * Area) / (Perimeter^2)
+    if (measurement.perimeter_polygon > 0.0)
+    {
+        measurement.circularity = (4.0 * M_PI * measurement.area_polygon) /
+                                  (measurement.perimeter_polygon * measurement.perimeter_polygon);
+    }
+
+    if (estimators.dss)
+    {
+        try
+        {
+            measurement.perimeter_dss = estimateDSSLength(theContour);
+        }
+        catch (const std::exception &)
+        {
+            measurement.perimeter_dss = std::numeric_limits<double>::quiet_NaN();
+        }
+    }
+    return measurement;
+}
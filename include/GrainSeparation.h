@@ -0,0 +1,342 @@
+#pragma once
+
+// Separation of touching grains (STEP 10).
+//
+// Grains that touch form a single connected component, which skews their area
+// and circularity. They are split along the valleys of the distance map:
+//
+//  1. Exact Euclidean distance transform of the mask (Meijster, Roerdink and
+//     Hesselink), in two separable linear passes: along the columns, then
+//     along the rows with the lower envelope of parabolas. Pixels outside the
+//     image count as background.
+//  2. Marker watershed: each component is flooded from its highest distances
+//     down, in parallel over the components. Every regional maximum
+//     starts a basin; when two basins meet, the one whose peak rises no more
+//     than `depth` pixels above the meeting level is merged into the other. The
+//     markers are therefore the maxima of dynamic > depth, one per grain, and
+//     the small maxima along the medial axis of an elongated grain, or on the
+//     irregularities of its boundary, do not split it.
+//  3. Cut: a pixel 4-adjacent to a pixel of a lower numbered basin is removed,
+//     so every basin becomes a 4-connected component of its own.
+//
+// Everything works on the foreground pixels only, numbered in raster order
+// through the runs of the label map, so the cost follows the grains and not
+// the image size. Along a row, the background pixels at both ends of a run
+// are nearer than any pixel beyond them, so the row pass of the transform
+// runs on each run on its own. The links between rows, the row pass and the
+// cut run in parallel; the column pass is one sweep in each direction.
+//
+// The cost is per foreground pixel, not per run as for the labeling: on an
+// 8000 x 8000 synthetic field, on one thread, about 0.8 s against 0.03 s to
+// label it (links 0.09 s, distance transform 0.26 s, flooding 0.4 s, cut
+// 0.06 s). Flooding is parallel over the components only, so a single large
+// blob of merged grains floods on one thread.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "MappedPGM.h"
+#include "RunLengthLabeling.h"
+#include "WorkStealingPool.h"
+
+// Foreground pixels of a label map, in raster order, with their 4-neighbours
+struct ForegroundPixels
+{
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+    enum Side : uint8_t
+    {
+        LEFT = 1,
+        RIGHT = 2
+    };
+
+    std::vector<size_t> runOffsets; // First pixel of each run, plus the total count
+    std::vector<uint32_t> up;       // Pixel above (y - 1), or NONE
+    std::vector<uint32_t> down;     // Pixel below (y + 1), or NONE
+    std::vector<uint8_t> sides;     // LEFT and RIGHT when those neighbours are foreground
+
+    size_t size() const { return runOffsets.back(); }
+};
+
+// Function to number the foreground pixels of a label map and link them to
+// their neighbours (fewer than 2^32 foreground pixels)
+inline ForegroundPixels linkForegroundPixels(const RunLengthLabelMap &map, WorkStealingPool &pool)
+{
+    ForegroundPixels pixels;
+    pixels.runOffsets.resize(map.runs.size() + 1, 0);
+    for (size_t r = 0; r < map.runs.size(); ++r)
+        pixels.runOffsets[r + 1] = pixels.runOffsets[r] + (map.runs[r].xEnd - map.runs[r].xBegin);
+    const size_t count = pixels.size();
+    pixels.up.assign(count, ForegroundPixels::NONE);
+    pixels.down.assign(count, ForegroundPixels::NONE);
+    pixels.sides.assign(count, ForegroundPixels::LEFT | ForegroundPixels::RIGHT);
+
+    // Each row against the previous one: the overlaps of their runs
+    pool.parallelFor(static_cast<size_t>(map.height), [&](size_t y, unsigned)
+    {
+        const size_t first = map.rowOffsets[y];
+        const size_t last = map.rowOffsets[y + 1];
+        for (size_t r = first; r < last; ++r)
+        {
+            pixels.sides[pixels.runOffsets[r]] &= ~ForegroundPixels::LEFT;
+            pixels.sides[pixels.runOffsets[r + 1] - 1] &= ~ForegroundPixels::RIGHT;
+        }
+        if (y == 0)
+            return;
+
+        size_t p = map.rowOffsets[y - 1];
+        const size_t previousLast = map.rowOffsets[y];
+        for (size_t r = first; r < last; ++r)
+        {
+            const PixelRun &run = map.runs[r];
+            while (p < previousLast && map.runs[p].xEnd <= run.xBegin)
+                ++p;
+            for (size_t q = p; q < previousLast && map.runs[q].xBegin < run.xEnd; ++q)
+            {
+                const PixelRun &above = map.runs[q];
+                const int x0 = std::max(run.xBegin, above.xBegin);
+                const int x1 = std::min(run.xEnd, above.xEnd);
+                for (int x = x0; x < x1; ++x)
+                {
+                    // Row y alone links the pixels of row y - 1 downwards
+                    const size_t i = pixels.runOffsets[r] + (x - run.xBegin);
+                    const size_t j = pixels.runOffsets[q] + (x - above.xBegin);
+                    pixels.up[i] = static_cast<uint32_t>(j);
+                    pixels.down[j] = static_cast<uint32_t>(i);
+                }
+            }
+        }
+    });
+    return pixels;
+}
+
+// Function to compute the squared Euclidean distance of every foreground
+// pixel to the nearest background pixel
+inline std::vector<uint32_t> squaredDistanceTransform(const RunLengthLabelMap &map, const ForegroundPixels &pixels,
+                                                      WorkStealingPool &pool)
+{
+    const size_t count = pixels.size();
+    std::vector<uint32_t> distances(count);
+
+    // Column pass: distance to the background above, then below. Pixels are
+    // in raster order, so the pixel above (below) is always done before. It
+    // stays one serial sweep in each direction: split into blocks of columns
+    // it was measured slower, at every thread count.
+    for (size_t i = 0; i < count; ++i)
+        distances[i] = pixels.up[i] != ForegroundPixels::NONE ? distances[pixels.up[i]] + 1 : 1;
+    for (size_t i = count; i-- > 0;)
+    {
+        if (pixels.down[i] != ForegroundPixels::NONE)
+            distances[i] = std::min(distances[i], distances[pixels.down[i]] + 1);
+        else
+            distances[i] = 1;
+    }
+
+    // Row pass: lower envelope of the parabolas (x - i)^2 + g(i)^2 over each
+    // run and the background pixel at both of its ends
+    std::vector<std::vector<int64_t>> scratch(pool.size());
+    pool.parallelFor(map.runs.size(), [&](size_t r, unsigned worker)
+    {
+        const size_t length = pixels.runOffsets[r + 1] - pixels.runOffsets[r];
+        const int64_t n = static_cast<int64_t>(length) + 2;
+        std::vector<int64_t> &buffer = scratch[worker];
+        buffer.resize(3 * static_cast<size_t>(n));
+        int64_t *g = buffer.data(); // Squared column distances, 0 at both ends
+        int64_t *s = g + n;         // Apex of each parabola of the envelope
+        int64_t *t = s + n;         // First position where it is the lowest one
+        uint32_t *row = distances.data() + pixels.runOffsets[r];
+        g[0] = 0;
+        g[n - 1] = 0;
+        for (int64_t u = 1; u < n - 1; ++u)
+            g[u] = static_cast<int64_t>(row[u - 1]) * row[u - 1];
+
+        auto f = [&](int64_t x, int64_t i) { return (x - i) * (x - i) + g[i]; };
+        auto separation = [&](int64_t i, int64_t u) { return (u * u - i * i + g[u] - g[i]) / (2 * (u - i)); };
+
+        int64_t q = 0;
+        s[0] = 0;
+        t[0] = 0;
+        for (int64_t u = 1; u < n; ++u)
+        {
+            while (q >= 0 && f(t[q], s[q]) > f(t[q], u))
+                --q;
+            if (q < 0)
+            {
+                q = 0;
+                s[0] = u;
+            }
+            else
+            {
+                const int64_t w = 1 + separation(s[q], u);
+                if (w < n)
+                {
+                    ++q;
+                    s[q] = u;
+                    t[q] = w;
+                }
+            }
+        }
+        for (int64_t u = n - 1; u >= 1; --u)
+        {
+            if (u < n - 1)
+                row[u - 1] = static_cast<uint32_t>(f(u, s[q]));
+            if (u == t[q])
+                --q;
+        }
+    });
+    return distances;
+}
+
+// Function to split the touching grains of a labeled mask; depth is the least
+// height, in pixels, of a distance maximum above its saddle for it to be a
+// grain of its own
+inline PackedBitmap separateTouchingGrains(const RunLengthLabelMap &map, double depth, WorkStealingPool &pool)
+{
+    const ForegroundPixels pixels = linkForegroundPixels(map, pool);
+    const std::vector<uint32_t> distances = squaredDistanceTransform(map, pixels, pool);
+
+    // Runs of every component: basins never spread over two components, so
+    // each one is flooded on its own, in parallel and within the cache
+    const size_t components = map.records.size();
+    std::vector<size_t> componentStarts(components + 1, 0);
+    for (const PixelRun &run : map.runs)
+        componentStarts[run.label]++;
+    for (size_t c = 0; c < components; ++c)
+        componentStarts[c + 1] += componentStarts[c];
+    std::vector<uint32_t> componentRuns(map.runs.size());
+    {
+        std::vector<size_t> next(componentStarts.begin(), componentStarts.end() - 1);
+        for (size_t r = 0; r < map.runs.size(); ++r)
+            componentRuns[next[map.runs[r].label - 1]++] = static_cast<uint32_t>(r);
+    }
+
+    // Basin of every pixel, numbered within its component
+    std::vector<uint32_t> basinOf(pixels.size(), 0);
+
+    struct FloodScratch
+    {
+        std::vector<size_t> starts;
+        std::vector<uint32_t> order;
+        std::vector<uint32_t> parent;
+        std::vector<float> peak;
+    };
+    std::vector<FloodScratch> scratch(pool.size());
+    pool.parallelFor(components, [&](size_t c, unsigned worker)
+    {
+        FloodScratch &work = scratch[worker];
+        std::vector<uint32_t> &parent = work.parent;
+        std::vector<float> &peak = work.peak;
+        auto find = [&](uint32_t b)
+        {
+            while (parent[b] != b)
+            {
+                parent[b] = parent[parent[b]];
+                b = parent[b];
+            }
+            return b;
+        };
+
+        // Pixels of the component by decreasing distance (counting sort)
+        uint32_t maxDistance = 0;
+        size_t size = 0;
+        for (size_t k = componentStarts[c]; k < componentStarts[c + 1]; ++k)
+        {
+            const size_t r = componentRuns[k];
+            for (size_t i = pixels.runOffsets[r]; i < pixels.runOffsets[r + 1]; ++i)
+                maxDistance = std::max(maxDistance, distances[i]);
+            size += pixels.runOffsets[r + 1] - pixels.runOffsets[r];
+        }
+        std::vector<size_t> &starts = work.starts;
+        starts.assign(static_cast<size_t>(maxDistance) + 2, 0);
+        for (size_t k = componentStarts[c]; k < componentStarts[c + 1]; ++k)
+        {
+            const size_t r = componentRuns[k];
+            for (size_t i = pixels.runOffsets[r]; i < pixels.runOffsets[r + 1]; ++i)
+                starts[maxDistance - distances[i] + 1]++;
+        }
+        for (size_t k = 1; k < starts.size(); ++k)
+            starts[k] += starts[k - 1];
+        std::vector<uint32_t> &order = work.order;
+        order.resize(size);
+        for (size_t k = componentStarts[c]; k < componentStarts[c + 1]; ++k)
+        {
+            const size_t r = componentRuns[k];
+            for (size_t i = pixels.runOffsets[r]; i < pixels.runOffsets[r + 1]; ++i)
+                order[starts[maxDistance - distances[i]]++] = static_cast<uint32_t>(i);
+        }
+
+        // Flooding, with a union-find over the basins (basinOf is basin + 1, 0 until flooded)
+        parent.clear();
+        peak.clear();
+        for (uint32_t i : order)
+        {
+            const float level = std::sqrt(static_cast<float>(distances[i]));
+
+            uint32_t roots[4];
+            int found = 0;
+            auto visit = [&](uint32_t j)
+            {
+                if (j != ForegroundPixels::NONE && basinOf[j] != 0)
+                    roots[found++] = find(basinOf[j] - 1);
+            };
+            visit((pixels.sides[i] & ForegroundPixels::LEFT) ? i - 1 : ForegroundPixels::NONE);
+            visit((pixels.sides[i] & ForegroundPixels::RIGHT) ? i + 1 : ForegroundPixels::NONE);
+            visit(pixels.up[i]);
+            visit(pixels.down[i]);
+
+            if (found == 0)
+            {
+                // A regional maximum: a new basin
+                parent.push_back(static_cast<uint32_t>(parent.size()));
+                peak.push_back(level);
+                basinOf[i] = static_cast<uint32_t>(parent.size());
+                continue;
+            }
+
+            // The pixel goes to the highest basin; the shallow ones merge into it
+            uint32_t top = roots[0];
+            for (int k = 1; k < found; ++k)
+            {
+                if (peak[roots[k]] > peak[top] || (peak[roots[k]] == peak[top] && roots[k] < top))
+                    top = roots[k];
+            }
+            for (int k = 0; k < found; ++k)
+            {
+                if (roots[k] != top && peak[roots[k]] - level <= depth)
+                    parent[roots[k]] = top;
+            }
+            basinOf[i] = top + 1;
+        }
+        for (uint32_t i : order)
+            basinOf[i] = find(basinOf[i] - 1);
+    });
+
+    // Cut between basins, row by row
+    PackedBitmap separated;
+    separated.width = map.width;
+    separated.height = map.height;
+    separated.wordsPerRow = (static_cast<size_t>(map.width) + 63) / 64;
+    separated.words.assign(separated.wordsPerRow * map.height, 0);
+    pool.parallelFor(static_cast<size_t>(map.height), [&](size_t y, unsigned)
+    {
+        uint64_t *out = separated.words.data() + y * separated.wordsPerRow;
+        for (size_t r = map.rowOffsets[y]; r < map.rowOffsets[y + 1]; ++r)
+        {
+            const PixelRun &run = map.runs[r];
+            for (int x = run.xBegin; x < run.xEnd; ++x)
+            {
+                const uint32_t i = static_cast<uint32_t>(pixels.runOffsets[r] + (x - run.xBegin));
+                const uint32_t basin = basinOf[i];
+                auto lower = [&](uint32_t j) { return j != ForegroundPixels::NONE && basinOf[j] < basin; };
+                if ((x > run.xBegin && lower(i - 1)) || (x + 1 < run.xEnd && lower(i + 1)) ||
+                    lower(pixels.up[i]) || lower(pixels.down[i]))
+                    continue;
+                out[x >> 6] |= uint64_t(1) << (x & 63);
+            }
+        }
+    });
+    return separated;
+}
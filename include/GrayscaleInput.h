@@ -0,0 +1,144 @@
+#pragma once
+
+// Grayscale scans as input, thresholded on the fly.
+//
+// A scan is never binarized into a mask: its foreground is the range of gray
+// levels (threshold, 255], which the labeling, the tracing and the packing
+// test pixel by pixel as they read the rows (BinaryMaskView, packRow). The
+// threshold is either given, or found by Otsu's method on the histogram of
+// the image, in one extra pass over the pixels.
+//
+// The histogram keeps four interleaved tables of counters, so that runs of
+// equal pixels, the common case on scans, do not serialize on one counter.
+// They live as long as the histogram and are summed once, when it is read.
+// PNG files are decoded to 8-bit gray with libpng when it was found at build
+// time (HAVE_PNG); PGM files are mapped as before.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(HAVE_PNG)
+#include <png.h>
+#endif
+
+// Histogram of the gray levels of an image
+struct GrayHistogram
+{
+    uint64_t tables[4][256] = {}; // Pixel x is counted in table x % 4
+
+    // Function to count the pixels of one row
+    void addRow(const unsigned char *row, int width)
+    {
+        int x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            tables[0][row[x]]++;
+            tables[1][row[x + 1]]++;
+            tables[2][row[x + 2]]++;
+            tables[3][row[x + 3]]++;
+        }
+        for (; x < width; ++x)
+            tables[0][row[x]]++;
+    }
+
+    // Function to count the pixels of a whole image
+    void addImage(const unsigned char *pixels, int width, int height, size_t stride)
+    {
+        for (int y = 0; y < height; ++y)
+            addRow(pixels + static_cast<size_t>(y) * stride, width);
+    }
+
+    // Function to sum the four tables into the count of every gray level
+    void fold(uint64_t counts[256]) const
+    {
+        for (int v = 0; v < 256; ++v)
+            counts[v] = tables[0][v] + tables[1][v] + tables[2][v] + tables[3][v];
+    }
+};
+
+// Function to find the Otsu threshold of a histogram: the level t that
+// maximizes the variance between the classes [0, t] and (t, 255]
+inline int otsuThreshold(const GrayHistogram &histogram)
+{
+    uint64_t counts[256];
+    histogram.fold(counts);
+    double total = 0.0, sum = 0.0;
+    for (int v = 0; v < 256; ++v)
+    {
+        total += static_cast<double>(counts[v]);
+        sum += static_cast<double>(v) * counts[v];
+    }
+
+    int best = 0;
+    double bestVariance = -1.0;
+    double weight = 0.0, weightedSum = 0.0;
+    for (int t = 0; t < 255; ++t)
+    {
+        weight += static_cast<double>(counts[t]);
+        weightedSum += static_cast<double>(t) * counts[t];
+        if (weight == 0.0 || weight == total)
+            continue;
+        const double meanBelow = weightedSum / weight;
+        const double meanAbove = (sum - weightedSum) / (total - weight);
+        const double variance = weight * (total - weight) * (meanBelow - meanAbove) * (meanBelow - meanAbove);
+        if (variance > bestVariance)
+        {
+            bestVariance = variance;
+            best = t;
+        }
+    }
+    return best;
+}
+
+// 8-bit grayscale image decoded in memory
+struct GrayImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels; // width bytes per row
+
+    bool empty() const { return pixels.empty(); }
+};
+
+// Function to tell PNG files from PGM files by their extension
+inline bool isPNGFileName(const std::string &fileName)
+{
+    const size_t dot = fileName.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+    std::string extension = fileName.substr(dot + 1);
+    for (char &c : extension)
+        c = static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+    return extension == "png";
+}
+
+// Function to decode a PNG file to 8-bit gray (colors are converted to luminance)
+inline GrayImage readPNG(const std::string &fileName)
+{
+#if defined(HAVE_PNG)
+    png_image image;
+    std::memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, fileName.c_str()))
+        throw std::runtime_error(fileName + ": " + image.message);
+
+    image.format = PNG_FORMAT_GRAY;
+    GrayImage gray;
+    gray.width = static_cast<int>(image.width);
+    gray.height = static_cast<int>(image.height);
+    gray.pixels.resize(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, nullptr, gray.pixels.data(), 0, nullptr))
+    {
+        const std::string message = image.message;
+        png_image_free(&image);
+        throw std::runtime_error(fileName + ": " + message);
+    }
+    return gray;
+#else
+    throw std::runtime_error(fileName + ": built without PNG support (libpng not found)");
+#endif
+}
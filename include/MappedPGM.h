@@ -0,0 +1,283 @@
+#pragma once
+
+// Zero-copy reader for binary (P5) 8-bit PGM files.
+//
+// The file is memory-mapped read-only and the pixels are exposed in place:
+// pixels() points into the mapping, row y starts at pixels() + y * stride().
+// No copy of the image is made, which matters when the same mask would
+// otherwise live in a DGtal image and in a digital set at the same time.
+//
+// PackedBitmap holds a 1 bit-per-pixel version of a mask (bit x % 64 of word
+// x / 64 of each row), built with a vectorized threshold when SSE2 is available.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Function to parse a "P5 <width> <height> <maxval>" header with # comments;
+// returns the offset of the first pixel, throws std::runtime_error when malformed
+inline size_t parsePGMHeader(const unsigned char *data, size_t size, const std::string &fileName,
+                             int &width, int &height, int &maxValue)
+{
+    size_t pos = 0;
+    auto skipSpaceAndComments = [&]()
+    {
+        while (pos < size)
+        {
+            if (data[pos] == '#')
+            {
+                while (pos < size && data[pos] != '\n')
+                    ++pos;
+            }
+            else if (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\r' || data[pos] == '\n')
+            {
+                ++pos;
+            }
+            else
+            {
+                break;
+            }
+        }
+    };
+    auto readNumber = [&]()
+    {
+        skipSpaceAndComments();
+        if (pos >= size || data[pos] < '0' || data[pos] > '9')
+            throw std::runtime_error(fileName + ": malformed PGM header");
+        long value = 0;
+        while (pos < size && data[pos] >= '0' && data[pos] <= '9')
+            value = value * 10 + (data[pos++] - '0');
+        return static_cast<int>(value);
+    };
+
+    if (size < 2 || data[0] != 'P' || data[1] != '5')
+        throw std::runtime_error(fileName + ": not a binary (P5) PGM file");
+    pos = 2;
+    width = readNumber();
+    height = readNumber();
+    maxValue = readNumber();
+    if (maxValue > 255)
+        throw std::runtime_error(fileName + ": only 8-bit PGM files are supported");
+    return pos + 1; // A single whitespace character ends the header
+}
+
+class MappedPGM
+{
+public:
+    MappedPGM() = default;
+    explicit MappedPGM(const std::string &fileName) { open(fileName); }
+    ~MappedPGM() { close(); }
+
+    MappedPGM(const MappedPGM &) = delete;
+    MappedPGM &operator=(const MappedPGM &) = delete;
+    MappedPGM(MappedPGM &&other) noexcept { *this = std::move(other); }
+    MappedPGM &operator=(MappedPGM &&other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            myData = other.myData;
+            mySize = other.mySize;
+            myPixels = other.myPixels;
+            myWidth = other.myWidth;
+            myHeight = other.myHeight;
+            myMaxValue = other.myMaxValue;
+            other.myData = nullptr;
+            other.mySize = 0;
+            other.myPixels = nullptr;
+        }
+        return *this;
+    }
+
+    // Function to map a P5 file; throws std::runtime_error on failure
+    void open(const std::string &fileName)
+    {
+        close();
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("cannot open " + fileName);
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + fileName);
+        }
+        mySize = static_cast<size_t>(info.st_size);
+
+        void *data = mmap(nullptr, mySize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+        {
+            mySize = 0;
+            throw std::runtime_error("cannot map " + fileName);
+        }
+        myData = static_cast<const unsigned char *>(data);
+        madvise(data, mySize, MADV_SEQUENTIAL);
+
+        size_t offset = parsePGMHeader(myData, mySize, fileName, myWidth, myHeight, myMaxValue);
+        if (offset + static_cast<size_t>(myWidth) * myHeight > mySize)
+            throw std::runtime_error(fileName + ": truncated pixel data");
+        myPixels = myData + offset;
+    }
+
+    void close()
+    {
+        if (myData != nullptr)
+            munmap(const_cast<unsigned char *>(myData), mySize);
+        myData = nullptr;
+        myPixels = nullptr;
+        mySize = 0;
+    }
+
+    const unsigned char *pixels() const { return myPixels; }
+    int width() const { return myWidth; }
+    int height() const { return myHeight; }
+    size_t stride() const { return static_cast<size_t>(myWidth); }
+    int maxValue() const { return myMaxValue; }
+
+private:
+    const unsigned char *myData = nullptr;
+    size_t mySize = 0;
+    const unsigned char *myPixels = nullptr;
+    int myWidth = 0;
+    int myHeight = 0;
+    int myMaxValue = 0;
+};
+
+// 1 bit-per-pixel mask
+struct PackedBitmap
+{
+    int width = 0;
+    int height = 0;
+    size_t wordsPerRow = 0;
+    std::vector<uint64_t> words;
+
+    const uint64_t *row(int y) const { return words.data() + static_cast<size_t>(y) * wordsPerRow; }
+
+    bool operator()(int x, int y) const
+    {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return false;
+        return (row(y)[x >> 6] >> (x & 63)) & 1u;
+    }
+};
+
+// Function to pack one row: bit x is set when minValue < row[x] <= maxValue
+inline void packRow(const unsigned char *row, int width, unsigned char minValue, unsigned char maxValue, uint64_t *out)
+{
+    int x = 0;
+    if (minValue >= maxValue)
+        return; // Empty range: no foreground
+#if defined(__SSE2__)
+    // Unsigned range test on 16 pixels at once: v - (minValue + 1) <= maxValue - (minValue + 1)
+    const __m128i bias = _mm_set1_epi8(static_cast<char>(0x80));
+    const __m128i low = _mm_set1_epi8(static_cast<char>(minValue + 1));
+    const __m128i span = _mm_xor_si128(_mm_set1_epi8(static_cast<char>(maxValue - minValue - 1)), bias);
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        __m128i shifted = _mm_xor_si128(_mm_sub_epi8(v, low), bias);
+        __m128i outside = _mm_cmpgt_epi8(shifted, span); // Signed compare on biased values
+        uint64_t bits = static_cast<uint16_t>(~_mm_movemask_epi8(outside));
+        out[x >> 6] |= bits << (x & 63);
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        if (row[x] > minValue && row[x] <= maxValue)
+            out[x >> 6] |= uint64_t(1) << (x & 63);
+    }
+}
+
+// Function to threshold a whole 8-bit image into a packed bitmap
+inline PackedBitmap packBitmap(const unsigned char *pixels, int width, int height, size_t stride,
+                               unsigned char minValue = 1, unsigned char maxValue = 255)
+{
+    PackedBitmap bitmap;
+    bitmap.width = width;
+    bitmap.height = height;
+    bitmap.wordsPerRow = (static_cast<size_t>(width) + 63) / 64;
+    bitmap.words.assign(bitmap.wordsPerRow * height, 0);
+    for (int y = 0; y < height; ++y)
+    {
+        packRow(pixels + static_cast<size_t>(y) * stride, width, minValue, maxValue,
+                bitmap.words.data() + static_cast<size_t>(y) * bitmap.wordsPerRow);
+    }
+    return bitmap;
+}
+
+// Reader of a P5 PGM file by horizontal strips, for images too large to keep
+// in memory: only the rows asked for are read, with positioned reads.
+class PGMStripReader
+{
+public:
+    explicit PGMStripReader(const std::string &fileName) : myFileName(fileName)
+    {
+        myFd = ::open(fileName.c_str(), O_RDONLY);
+        if (myFd < 0)
+            throw std::runtime_error("cannot open " + fileName);
+
+        unsigned char header[4096];
+        ssize_t got = pread(myFd, header, sizeof(header), 0);
+        if (got <= 0)
+        {
+            ::close(myFd);
+            throw std::runtime_error("cannot read " + fileName);
+        }
+        try
+        {
+            myOffset = parsePGMHeader(header, static_cast<size_t>(got), fileName, myWidth, myHeight, myMaxValue);
+        }
+        catch (...)
+        {
+            ::close(myFd);
+            throw;
+        }
+    }
+
+    ~PGMStripReader() { ::close(myFd); }
+
+    PGMStripReader(const PGMStripReader &) = delete;
+    PGMStripReader &operator=(const PGMStripReader &) = delete;
+
+    int width() const { return myWidth; }
+    int height() const { return myHeight; }
+
+    // Function to read rows [firstRow, firstRow + rows) into buffer (width bytes per row)
+    void readRows(int firstRow, int rows, std::vector<unsigned char> &buffer) const
+    {
+        const size_t bytes = static_cast<size_t>(rows) * myWidth;
+        buffer.resize(bytes);
+        size_t done = 0;
+        off_t position = static_cast<off_t>(myOffset + static_cast<size_t>(firstRow) * myWidth);
+        while (done < bytes)
+        {
+            ssize_t got = pread(myFd, buffer.data() + done, bytes - done, position + static_cast<off_t>(done));
+            if (got <= 0)
+                throw std::runtime_error(myFileName + ": truncated pixel data");
+            done += static_cast<size_t>(got);
+        }
+    }
+
+private:
+    std::string myFileName;
+    int myFd = -1;
+    size_t myOffset = 0;
+    int myWidth = 0;
+    int myHeight = 0;
+    int myMaxValue = 0;
+};
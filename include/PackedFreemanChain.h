@@ -0,0 +1,186 @@
+#pragma once
+
+// Packed 4-connected Freeman chain code.
+//
+// Codes are stored on 2 bits each (32 steps per 64-bit word) together with an
+// explicit start point. The end point is maintained while codes are appended,
+// so closure tests and endpoint queries are O(1) and no text representation
+// is ever built or parsed.
+//
+// ConstIterator walks the points of the chain like FreemanChain<int>::ConstIterator:
+// it visits size() + 1 points, from the start point to the end point, and is
+// bidirectional so it can feed ArithmeticalDSSComputer and GreedySegmentation
+// directly. TPoint only needs a (x, y) constructor and operator[] (Z2i::Point).
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+template <typename TPoint>
+class PackedFreemanChain
+{
+public:
+    typedef TPoint Point;
+
+    PackedFreemanChain() : myFirst(0, 0), myLast(0, 0) {}
+    PackedFreemanChain(int x0, int y0) : myFirst(x0, y0), myLast(x0, y0) {}
+
+    // Function to empty the chain and move its start point
+    void reset(int x0, int y0)
+    {
+        myWords.clear();
+        mySize = 0;
+        myFirst = Point(x0, y0);
+        myLast = myFirst;
+    }
+
+    void reserve(size_t steps) { myWords.reserve((steps + 31) / 32); }
+
+    // Packed codes, 32 per word, for serialization
+    const std::vector<uint64_t> &words() const { return myWords; }
+
+    // Function to rebuild a chain from its start point and packed codes
+    void assign(int x0, int y0, size_t steps, std::vector<uint64_t> words)
+    {
+        myWords = std::move(words);
+        myWords.resize((steps + 31) / 32);
+        mySize = steps;
+        myFirst = Point(x0, y0);
+        int x = x0, y = y0;
+        for (size_t i = 0; i < steps; ++i)
+        {
+            x += dx(code(i));
+            y += dy(code(i));
+        }
+        myLast = Point(x, y);
+    }
+
+    // Function to append one step (0: East, 1: North, 2: West, 3: South)
+    void push_back(int code)
+    {
+        const size_t shift = (mySize & 31) * 2;
+        if (shift == 0)
+            myWords.push_back(0);
+        myWords.back() |= static_cast<uint64_t>(code & 3) << shift;
+        ++mySize;
+        myLast = Point(myLast[0] + dx(code), myLast[1] + dy(code));
+    }
+
+    int code(size_t i) const
+    {
+        return static_cast<int>((myWords[i >> 5] >> ((i & 31) * 2)) & 3);
+    }
+
+    size_t size() const { return mySize; }
+    bool empty() const { return mySize == 0; }
+
+    const Point &firstPoint() const { return myFirst; }
+    const Point &lastPoint() const { return myLast; }
+    bool isClosed() const { return myFirst == myLast; }
+
+    // Function to append the steps that bring the end point back to the
+    // start point: diagonal gaps are split into alternating horizontal and
+    // vertical moves, then the remaining straight gap is filled.
+    void close()
+    {
+        int deltaX = myFirst[0] - myLast[0];
+        int deltaY = myFirst[1] - myLast[1];
+        while (deltaX != 0 && deltaY != 0)
+        {
+            push_back(deltaX > 0 ? 0 : 2);
+            deltaX += deltaX > 0 ? -1 : 1;
+            push_back(deltaY > 0 ? 1 : 3);
+            deltaY += deltaY > 0 ? -1 : 1;
+        }
+        for (; deltaX > 0; --deltaX) push_back(0);
+        for (; deltaX < 0; ++deltaX) push_back(2);
+        for (; deltaY > 0; --deltaY) push_back(1);
+        for (; deltaY < 0; ++deltaY) push_back(3);
+    }
+
+    static int dx(int code) { return code == 0 ? 1 : (code == 2 ? -1 : 0); }
+    static int dy(int code) { return code == 1 ? 1 : (code == 3 ? -1 : 0); }
+
+    // Bidirectional iterator over the size() + 1 points of the chain
+    class ConstIterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef TPoint value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const TPoint *pointer;
+        typedef const TPoint &reference;
+
+        ConstIterator() : myChain(nullptr), myIndex(0), myPoint(0, 0) {}
+        ConstIterator(const PackedFreemanChain *chain, size_t index, const TPoint &point)
+            : myChain(chain), myIndex(index), myPoint(point) {}
+
+        reference operator*() const { return myPoint; }
+        pointer operator->() const { return &myPoint; }
+
+        // Index of the current point, 0 for the start point
+        size_t position() const { return myIndex; }
+
+        ConstIterator &operator++()
+        {
+            if (myIndex < myChain->size())
+            {
+                int c = myChain->code(myIndex);
+                myPoint = TPoint(myPoint[0] + dx(c), myPoint[1] + dy(c));
+            }
+            ++myIndex;
+            return *this;
+        }
+
+        ConstIterator operator++(int)
+        {
+            ConstIterator tmp(*this);
+            ++(*this);
+            return tmp;
+        }
+
+        ConstIterator &operator--()
+        {
+            --myIndex;
+            if (myIndex == myChain->size())
+            {
+                myPoint = myChain->lastPoint(); // Coming back from end()
+            }
+            else
+            {
+                int c = myChain->code(myIndex);
+                myPoint = TPoint(myPoint[0] - dx(c), myPoint[1] - dy(c));
+            }
+            return *this;
+        }
+
+        ConstIterator operator--(int)
+        {
+            ConstIterator tmp(*this);
+            --(*this);
+            return tmp;
+        }
+
+        bool operator==(const ConstIterator &other) const
+        {
+            return myChain == other.myChain && myIndex == other.myIndex;
+        }
+        bool operator!=(const ConstIterator &other) const { return !(*this == other); }
+
+    private:
+        const PackedFreemanChain *myChain;
+        size_t myIndex;
+        TPoint myPoint;
+    };
+
+    ConstIterator begin() const { return ConstIterator(this, 0, myFirst); }
+    ConstIterator end() const { return ConstIterator(this, mySize + 1, myLast); }
+
+private:
+    std::vector<uint64_t> myWords;
+    size_t mySize = 0;
+    Point myFirst;
+    Point myLast;
+};
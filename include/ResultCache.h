@@ -0,0 +1,273 @@
+#pragma once
+
+// On-disk cache of the per-grain results of a mask, addressed by its content.
+//
+// The key is the 64-bit XXH64 hash of the pixels, of the image size and of
+// every parameter that changes the results (cache format, adjacency,
+// foreground range, estimators). An unchanged mask therefore finds its
+// contours and measurements in <directory>/<key>.grains and skips labeling,
+// tracing and measuring; only the report and the aggregation run again.
+//
+// Entries are written to a temporary file and renamed, so a reader never sees
+// a partial entry, and two runs sharing the directory cannot corrupt it.
+// They are in host byte order and only meant to be read on the same machine.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ContourTracing.h"
+#include "GrainMeasurement.h"
+
+// Streaming XXH64 hash
+class ContentHasher
+{
+public:
+    explicit ContentHasher(uint64_t seed = 0) : mySeed(seed)
+    {
+        myLanes[0] = seed + P1 + P2;
+        myLanes[1] = seed + P2;
+        myLanes[2] = seed;
+        myLanes[3] = seed - P1;
+    }
+
+    // Function to hash the next bytes of the stream
+    void update(const void *data, size_t size)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        myLength += size;
+
+        // Complete a pending stripe first
+        if (myPending > 0)
+        {
+            const size_t take = std::min(size, sizeof(myStripe) - myPending);
+            std::memcpy(myStripe + myPending, bytes, take);
+            myPending += take;
+            bytes += take;
+            size -= take;
+            if (myPending < sizeof(myStripe))
+                return;
+            consumeStripe(myStripe);
+            myPending = 0;
+        }
+        for (; size >= sizeof(myStripe); bytes += sizeof(myStripe), size -= sizeof(myStripe))
+            consumeStripe(bytes);
+        std::memcpy(myStripe, bytes, size);
+        myPending = size;
+    }
+
+    template <typename T>
+    void updateValue(const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "plain values only");
+        update(&value, sizeof(T));
+    }
+
+    uint64_t digest() const
+    {
+        uint64_t hash;
+        if (myLength >= sizeof(myStripe))
+        {
+            hash = rotl(myLanes[0], 1) + rotl(myLanes[1], 7) + rotl(myLanes[2], 12) + rotl(myLanes[3], 18);
+            for (uint64_t lane : myLanes)
+                hash = (hash ^ round(0, lane)) * P1 + P4;
+        }
+        else
+        {
+            hash = mySeed + P5;
+        }
+        hash += myLength;
+
+        const unsigned char *p = myStripe;
+        size_t left = myPending;
+        for (; left >= 8; p += 8, left -= 8)
+            hash = rotl(hash ^ round(0, read64(p)), 27) * P1 + P4;
+        if (left >= 4)
+        {
+            hash = rotl(hash ^ (static_cast<uint64_t>(read32(p)) * P1), 23) * P2 + P3;
+            p += 4;
+            left -= 4;
+        }
+        for (; left > 0; ++p, --left)
+            hash = rotl(hash ^ (*p * P5), 11) * P1;
+
+        hash ^= hash >> 33;
+        hash *= P2;
+        hash ^= hash >> 29;
+        hash *= P3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+private:
+    static constexpr uint64_t P1 = 11400714785074694791ULL;
+    static constexpr uint64_t P2 = 14029467366897019727ULL;
+    static constexpr uint64_t P3 = 1609587929392839161ULL;
+    static constexpr uint64_t P4 = 9650029242287828579ULL;
+    static constexpr uint64_t P5 = 2870177450012600261ULL;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t round(uint64_t lane, uint64_t input) { return rotl(lane + input * P2, 31) * P1; }
+    static uint64_t read64(const unsigned char *p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+    }
+    static uint32_t read32(const unsigned char *p)
+    {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+    }
+
+    void consumeStripe(const unsigned char *p)
+    {
+        for (int i = 0; i < 4; ++i)
+            myLanes[i] = round(myLanes[i], read64(p + 8 * i));
+    }
+
+    uint64_t mySeed;
+    uint64_t myLanes[4];
+    unsigned char myStripe[32];
+    size_t myPending = 0;
+    uint64_t myLength = 0;
+};
+
+// Results of one mask as stored in the cache
+struct CachedGrains
+{
+    size_t initialComponents = 0;
+    size_t removedComponents = 0;
+    std::vector<TracedContour<DGtal::Z2i::Point>> contours;
+    std::vector<GrainMeasurement> measurements;
+};
+
+class ResultCache
+{
+public:
+    explicit ResultCache(const std::string &directory) : myDirectory(directory) {}
+
+    // Function to name the entry of a key
+    std::string entryName(uint64_t key) const
+    {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.grains", static_cast<unsigned long long>(key));
+        return myDirectory + "/" + name;
+    }
+
+    // Function to read an entry; returns false when it is missing or unreadable
+    bool load(uint64_t key, CachedGrains &grains) const
+    {
+        std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(std::fopen(entryName(key).c_str(), "rb"), &std::fclose);
+        if (!file)
+            return false;
+        std::FILE *in = file.get();
+
+        char magic[8];
+        uint32_t version = 0;
+        uint64_t storedKey = 0, initial = 0, removed = 0, count = 0;
+        if (std::fread(magic, 1, 8, in) != 8 || std::memcmp(magic, "GRAINCAC", 8) != 0 ||
+            !readValue(in, version) || version != VERSION || !readValue(in, storedKey) || storedKey != key ||
+            !readValue(in, initial) || !readValue(in, removed) || !readValue(in, count))
+            return false;
+
+        CachedGrains loaded;
+        loaded.initialComponents = initial;
+        loaded.removedComponents = removed;
+        loaded.contours.resize(count);
+        loaded.measurements.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            TracedContour<DGtal::Z2i::Point> &contour = loaded.contours[i];
+            int32_t x0 = 0, y0 = 0;
+            uint64_t steps = 0;
+            if (!readValue(in, contour.label) || !readValue(in, x0) || !readValue(in, y0) || !readValue(in, steps))
+                return false;
+            std::vector<uint64_t> words((steps + 31) / 32);
+            if (std::fread(words.data(), sizeof(uint64_t), words.size(), in) != words.size())
+                return false;
+            contour.chain.assign(x0, y0, steps, std::move(words));
+
+            GrainMeasurement &measurement = loaded.measurements[i];
+            uint16_t errorLength = 0;
+            if (!readValue(in, measurement.area_2cells) || !readValue(in, measurement.area_polygon) ||
+                !readValue(in, measurement.perimeter_boundary) || !readValue(in, measurement.perimeter_polygon) ||
+                !readValue(in, measurement.perimeter_dss) || !readValue(in, measurement.circularity) ||
+                !readValue(in, measurement.moments) || !readValue(in, errorLength))
+                return false;
+            measurement.error.resize(errorLength);
+            if (errorLength > 0 && std::fread(&measurement.error[0], 1, errorLength, in) != errorLength)
+                return false;
+        }
+        grains = std::move(loaded);
+        return true;
+    }
+
+    // Function to write an entry; failures only cost a recomputation later
+    void store(uint64_t key, const CachedGrains &grains) const
+    {
+        const std::string name = entryName(key);
+        const std::string temporary = name + ".tmp" + std::to_string(::getpid());
+        std::FILE *out = std::fopen(temporary.c_str(), "wb");
+        if (out == nullptr)
+            return;
+
+        std::fwrite("GRAINCAC", 1, 8, out);
+        writeValue(out, VERSION);
+        writeValue(out, key);
+        writeValue(out, static_cast<uint64_t>(grains.initialComponents));
+        writeValue(out, static_cast<uint64_t>(grains.removedComponents));
+        writeValue(out, static_cast<uint64_t>(grains.contours.size()));
+        for (size_t i = 0; i < grains.contours.size(); ++i)
+        {
+            const TracedContour<DGtal::Z2i::Point> &contour = grains.contours[i];
+            writeValue(out, contour.label);
+            writeValue(out, static_cast<int32_t>(contour.chain.firstPoint()[0]));
+            writeValue(out, static_cast<int32_t>(contour.chain.firstPoint()[1]));
+            writeValue(out, static_cast<uint64_t>(contour.chain.size()));
+            std::fwrite(contour.chain.words().data(), sizeof(uint64_t), contour.chain.words().size(), out);
+
+            const GrainMeasurement &measurement = grains.measurements[i];
+            writeValue(out, measurement.area_2cells);
+            writeValue(out, measurement.area_polygon);
+            writeValue(out, measurement.perimeter_boundary);
+            writeValue(out, measurement.perimeter_polygon);
+            writeValue(out, measurement.perimeter_dss);
+            writeValue(out, measurement.circularity);
+            writeValue(out, measurement.moments);
+            writeValue(out, static_cast<uint16_t>(measurement.error.size()));
+            std::fwrite(measurement.error.data(), 1, measurement.error.size(), out);
+        }
+
+        const bool failed = std::ferror(out) != 0;
+        if (std::fclose(out) != 0 || failed || std::rename(temporary.c_str(), name.c_str()) != 0)
+            std::remove(temporary.c_str());
+    }
+
+private:
+    static constexpr uint32_t VERSION = 2; // 2: a failed DSS length is NaN, not an error
+
+    template <typename T>
+    static bool readValue(std::FILE *in, T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "plain values only");
+        return std::fread(&value, sizeof(T), 1, in) == 1;
+    }
+
+    template <typename T>
+    static void writeValue(std::FILE *out, const T &value)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "plain values only");
+        std::fwrite(&value, sizeof(T), 1, out);
+    }
+
+    std::string myDirectory;
+};
@@ -0,0 +1,243 @@
+#pragma once
+
+// Online statistics of a stream of values, in bounded memory.
+//
+// RunningStatistics keeps the count, the mean and the variance (Welford's
+// update), the extremes, and a merging t-digest for the quantiles: values are
+// buffered, then merged into a sorted list of weighted centroids whose size is
+// bounded by the compression. Centroids stay single values as long as there are
+// few of them, so small data sets get exact medians; large ones get quantiles
+// that are most accurate near the tails, with O(compression) memory.
+//
+// Two accumulators merge with merge(), so per-thread or per-file statistics
+// can be combined into global ones without keeping the values.
+//
+// The const accessors never modify the accumulator, so concurrent readers are
+// safe: while values are buffered, they merge them into a copy of the
+// centroids. flush() merges them once for all, before many queries.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class RunningStatistics
+{
+public:
+    explicit RunningStatistics(double compression = 100.0) : myCompression(compression) {}
+
+    // Function to add one value
+    void add(double value, double weight = 1.0)
+    {
+        // Welford's update, weighted
+        myCount += weight;
+        const double delta = value - myMean;
+        myMean += delta * weight / myCount;
+        myM2 += delta * (value - myMean) * weight;
+        myMin = std::min(myMin, value);
+        myMax = std::max(myMax, value);
+
+        myBuffer.push_back({value, weight});
+        if (myBuffer.size() >= bufferCapacity())
+            compress();
+    }
+
+    // Function to add all the values seen by another accumulator
+    void merge(const RunningStatistics &other)
+    {
+        if (other.myCount == 0.0)
+            return;
+        if (myCount == 0.0)
+        {
+            const double compression = myCompression;
+            *this = other;
+            myCompression = compression;
+            compress();
+            return;
+        }
+
+        // Chan et al. combination of the two means and variances
+        const double count = myCount + other.myCount;
+        const double delta = other.myMean - myMean;
+        myM2 += other.myM2 + delta * delta * myCount * other.myCount / count;
+        myMean += delta * other.myCount / count;
+        myCount = count;
+        myMin = std::min(myMin, other.myMin);
+        myMax = std::max(myMax, other.myMax);
+
+        myBuffer.insert(myBuffer.end(), other.myCentroids.begin(), other.myCentroids.end());
+        myBuffer.insert(myBuffer.end(), other.myBuffer.begin(), other.myBuffer.end());
+        compress();
+    }
+
+    // Function to merge the buffered values into the centroids
+    void flush()
+    {
+        if (!myBuffer.empty())
+            compress();
+    }
+
+    size_t count() const { return static_cast<size_t>(myCount); }
+    bool empty() const { return myCount == 0.0; }
+    double mean() const { return myMean; }
+    double variance() const { return myCount > 0.0 ? myM2 / myCount : 0.0; } // Population variance
+    double stddev() const { return std::sqrt(variance()); }
+    double min() const { return myMin; }
+    double max() const { return myMax; }
+    double sum() const { return myMean * myCount; }
+
+    // Function to estimate the q-quantile (q in [0, 1]); exact while the digest
+    // holds single values, with the same interpolation as a sorted array:
+    // rank q * (count - 1), linear between neighbouring ranks
+    double quantile(double q) const
+    {
+        if (myCount == 0.0)
+            return 0.0;
+        std::vector<Centroid> merged;
+        const std::vector<Centroid> &centroids = digest(merged);
+        const double rank = std::min(std::max(q, 0.0), 1.0) * (myCount - 1.0);
+
+        // Centroid i stands for the ranks around its center
+        double before = 0.0;
+        double previousCenter = 0.0;
+        double previousMean = myMin;
+        for (const Centroid &centroid : centroids)
+        {
+            const double center = before + (centroid.weight - 1.0) / 2.0;
+            if (rank <= center)
+            {
+                if (center == previousCenter)
+                    return centroid.mean;
+                const double t = (rank - previousCenter) / (center - previousCenter);
+                return previousMean + t * (centroid.mean - previousMean);
+            }
+            before += centroid.weight;
+            previousCenter = center;
+            previousMean = centroid.mean;
+        }
+
+        const double last = myCount - 1.0;
+        if (last == previousCenter)
+            return myMax;
+        const double t = (rank - previousCenter) / (last - previousCenter);
+        return previousMean + t * (myMax - previousMean);
+    }
+
+    double median() const { return quantile(0.5); }
+
+    // Function to estimate the fraction of values not greater than value
+    double cdf(double value) const
+    {
+        if (myCount == 0.0 || value < myMin)
+            return 0.0;
+        if (value >= myMax)
+            return 1.0;
+        std::vector<Centroid> merged;
+        const std::vector<Centroid> &centroids = digest(merged);
+        double below = 0.0;
+        for (const Centroid &centroid : centroids)
+        {
+            if (centroid.mean > value)
+                break;
+            below += centroid.weight;
+        }
+        return below / myCount;
+    }
+
+    // Function to count the values in bins equal-width bins over [min(), max()]
+    std::vector<double> histogram(size_t bins) const
+    {
+        std::vector<double> counts(bins, 0.0);
+        if (bins == 0 || myCount == 0.0)
+            return counts;
+        std::vector<Centroid> merged;
+        const std::vector<Centroid> &centroids = digest(merged);
+        const double width = (myMax - myMin) / static_cast<double>(bins);
+        for (const Centroid &centroid : centroids)
+        {
+            size_t bin = width > 0.0 ? static_cast<size_t>((centroid.mean - myMin) / width) : 0;
+            counts[std::min(bin, bins - 1)] += centroid.weight;
+        }
+        return counts;
+    }
+
+private:
+    struct Centroid
+    {
+        double mean;
+        double weight;
+    };
+
+    size_t bufferCapacity() const { return static_cast<size_t>(5.0 * myCompression); }
+
+    // Function to get the centroids of all the values: the stored ones when
+    // nothing is buffered, else the merge of both, built in merged
+    const std::vector<Centroid> &digest(std::vector<Centroid> &merged) const
+    {
+        if (myBuffer.empty())
+            return myCentroids;
+        std::vector<Centroid> values(myBuffer);
+        values.insert(values.end(), myCentroids.begin(), myCentroids.end());
+        mergeCentroids(values, merged);
+        return merged;
+    }
+
+    // Function to merge the buffer into the sorted centroids
+    void compress()
+    {
+        myBuffer.insert(myBuffer.end(), myCentroids.begin(), myCentroids.end());
+        mergeCentroids(myBuffer, myCentroids);
+        myBuffer.clear();
+    }
+
+    // Function to sort values into centroids, merging neighbouring ones under
+    // the k1 scale function when there are too many; values is consumed
+    void mergeCentroids(std::vector<Centroid> &values, std::vector<Centroid> &centroids) const
+    {
+        centroids.clear();
+        std::sort(values.begin(), values.end(), [](const Centroid &a, const Centroid &b)
+                  { return a.mean < b.mean; });
+
+        if (values.size() <= static_cast<size_t>(2.0 * myCompression))
+        {
+            centroids.swap(values);
+            return;
+        }
+
+        const double total = myCount;
+        auto scale = [this](double q)
+        { return myCompression / (2.0 * M_PI) * std::asin(2.0 * std::min(std::max(q, 0.0), 1.0) - 1.0); };
+
+        double before = 0.0;
+        Centroid current = values.front();
+        double currentLimit = scale(0.0) + 1.0;
+        for (size_t i = 1; i < values.size(); ++i)
+        {
+            const Centroid &next = values[i];
+            if (scale((before + current.weight + next.weight) / total) <= currentLimit)
+            {
+                current.weight += next.weight;
+                current.mean += (next.mean - current.mean) * next.weight / current.weight;
+            }
+            else
+            {
+                before += current.weight;
+                centroids.push_back(current);
+                current = next;
+                currentLimit = scale(before / total) + 1.0;
+            }
+        }
+        centroids.push_back(current);
+    }
+
+    double myCompression;
+    double myCount = 0.0;
+    double myMean = 0.0;
+    double myM2 = 0.0;
+    double myMin = std::numeric_limits<double>::infinity();
+    double myMax = -std::numeric_limits<double>::infinity();
+    std::vector<Centroid> myCentroids; // Sorted by mean
+    std::vector<Centroid> myBuffer;
+};
@@ -0,0 +1,264 @@
+#pragma once
+
+// Out-of-core labeling of masks that are read in horizontal strips.
+//
+// StripLabeler receives the mask one row at a time (as a packed bit row) and
+// labels it with the same 4-connected run-length union-find as
+// labelRunLength(), but keeps only what later rows can still affect: the runs
+// of the previous row, the statistics of the components still open, and the
+// mask rows from the top of the oldest open component down to the current row.
+//
+// A component is complete as soon as a row contains none of its pixels: no
+// later row can touch it any more. It is then reported through a callback
+// while its rows are still in the window, so that its contour can be traced
+// with isForeground(). Peak memory depends on the strip height and on the
+// height of the tallest grain, not on the image size.
+//
+// Records are reported as components complete; their `label` field is a
+// provisional id. Sorting them by (startY, startX) gives the label order of
+// labelRunLength().
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "RunLengthLabeling.h"
+
+class StripLabeler
+{
+public:
+    StripLabeler(int width, int height)
+        : myWidth(width), myHeight(height), myWordsPerRow((static_cast<size_t>(width) + 63) / 64) {}
+
+    int width() const { return myWidth; }
+    int height() const { return myHeight; }
+    size_t wordsPerRow() const { return myWordsPerRow; }
+
+    // Number of mask rows currently held in the window
+    size_t retainedRows() const { return myRows.size(); }
+
+    // Foreground test on the rows still held; rows already dropped are
+    // only ever queried next to a complete grain, where they are background
+    bool operator()(int x, int y) const
+    {
+        if (x < 0 || x >= myWidth || y < myFirstRow || y >= myFirstRow + static_cast<int>(myRows.size()))
+            return false;
+        const std::vector<uint64_t> &row = myRows[static_cast<size_t>(y - myFirstRow)];
+        return (row[x >> 6] >> (x & 63)) & 1u;
+    }
+
+    // Function to add the next row of the mask (packed bits, wordsPerRow() words).
+    // onComplete(const GrainRecord &) is called for every component that the
+    // row closes.
+    template <typename TOnComplete>
+    void pushRow(const uint64_t *bits, TOnComplete &&onComplete)
+    {
+        const int y = myNextRow++;
+
+        // Keep the row in the window, reusing a dropped row when there is one
+        std::vector<uint64_t> row;
+        if (!mySpareRows.empty())
+        {
+            row = std::move(mySpareRows.back());
+            mySpareRows.pop_back();
+        }
+        row.assign(bits, bits + myWordsPerRow);
+        if (myRows.empty())
+            myFirstRow = y;
+        myRows.push_back(std::move(row));
+
+        // Runs of the new row, merged with the overlapping runs of the previous row
+        myCurrRuns.clear();
+        extractBitRowRuns(myRows.back().data(), myWidth, y, myCurrRuns);
+
+        size_t i = 0;
+        for (PixelRun &run : myCurrRuns)
+        {
+            // Previous runs ending before this one cannot overlap it nor any later run
+            while (i < myPrevRuns.size() && myPrevRuns[i].xEnd <= run.xBegin)
+                ++i;
+
+            uint32_t id = NO_ID;
+            for (size_t k = i; k < myPrevRuns.size() && myPrevRuns[k].xBegin < run.xEnd; ++k)
+            {
+                uint32_t other = find(myPrevRuns[k].label);
+                id = (id == NO_ID) ? other : unite(id, other);
+            }
+            if (id == NO_ID)
+                id = newComponent(run);
+
+            run.label = id;
+            GrainRecord &record = myRecords[id];
+            record.pixelCount += static_cast<uint64_t>(run.xEnd - run.xBegin);
+            record.minX = std::min(record.minX, run.xBegin);
+            record.maxX = std::max(record.maxX, run.xEnd - 1);
+            record.maxY = y;
+        }
+
+        // Point the new runs at their final roots
+        for (PixelRun &run : myCurrRuns)
+            run.label = find(run.label);
+
+        // Components seen on the previous row but not on this one are complete
+        myCompleted.clear();
+        for (const PixelRun &run : myPrevRuns)
+        {
+            uint32_t root = find(run.label);
+            if (myRecords[root].maxY < y && !myDone[root])
+            {
+                myDone[root] = true;
+                myCompleted.push_back(root);
+            }
+        }
+        report(onComplete);
+
+        // Ids merged away during this row are no longer referenced
+        for (uint32_t id : myMerged)
+            release(id);
+        myMerged.clear();
+
+        std::swap(myPrevRuns, myCurrRuns);
+        dropUnusedRows();
+    }
+
+    // Function to report the components still open after the last row
+    template <typename TOnComplete>
+    void finish(TOnComplete &&onComplete)
+    {
+        myCompleted.clear();
+        for (const PixelRun &run : myPrevRuns)
+        {
+            uint32_t root = find(run.label);
+            if (!myDone[root])
+            {
+                myDone[root] = true;
+                myCompleted.push_back(root);
+            }
+        }
+        report(onComplete);
+        myPrevRuns.clear();
+        dropUnusedRows();
+    }
+
+private:
+    static const uint32_t NO_ID = 0xffffffffu;
+
+    uint32_t newComponent(const PixelRun &run)
+    {
+        uint32_t id;
+        if (!myFreeIds.empty())
+        {
+            id = myFreeIds.back();
+            myFreeIds.pop_back();
+        }
+        else
+        {
+            id = static_cast<uint32_t>(myParent.size());
+            myParent.push_back(id);
+            myRecords.emplace_back();
+            myDone.push_back(false);
+        }
+        myParent[id] = id;
+        myDone[id] = false;
+
+        GrainRecord &record = myRecords[id];
+        record = GrainRecord();
+        record.label = id;
+        record.minX = run.xBegin;
+        record.maxX = run.xEnd - 1;
+        record.minY = run.y;
+        record.maxY = run.y;
+        record.startX = run.xBegin;
+        record.startY = run.y;
+        return id;
+    }
+
+    uint32_t find(uint32_t i)
+    {
+        while (myParent[i] != i)
+        {
+            myParent[i] = myParent[myParent[i]];
+            i = myParent[i];
+        }
+        return i;
+    }
+
+    // Function to merge two roots; the one whose first pixel comes first in
+    // raster order stays the root and receives the statistics of the other
+    uint32_t unite(uint32_t a, uint32_t b)
+    {
+        if (a == b)
+            return a;
+        GrainRecord &ra = myRecords[a];
+        GrainRecord &rb = myRecords[b];
+        if (rb.startY < ra.startY || (rb.startY == ra.startY && rb.startX < ra.startX))
+            return unite(b, a);
+
+        ra.pixelCount += rb.pixelCount;
+        ra.minX = std::min(ra.minX, rb.minX);
+        ra.maxX = std::max(ra.maxX, rb.maxX);
+        ra.minY = std::min(ra.minY, rb.minY);
+        ra.maxY = std::max(ra.maxY, rb.maxY);
+        myParent[b] = a;
+        myMerged.push_back(b);
+        return a;
+    }
+
+    void release(uint32_t id)
+    {
+        myFreeIds.push_back(id);
+    }
+
+    template <typename TOnComplete>
+    void report(TOnComplete &onComplete)
+    {
+        std::sort(myCompleted.begin(), myCompleted.end(), [this](uint32_t a, uint32_t b)
+                  { return myRecords[a].startY != myRecords[b].startY ? myRecords[a].startY < myRecords[b].startY
+                                                                       : myRecords[a].startX < myRecords[b].startX; });
+        for (uint32_t id : myCompleted)
+        {
+            GrainRecord &record = myRecords[id];
+            record.touchesBorder = record.minX == 0 || record.minY == 0 ||
+                                   record.maxX == myWidth - 1 || record.maxY == myHeight - 1;
+            onComplete(static_cast<const GrainRecord &>(record));
+        }
+        for (uint32_t id : myCompleted)
+            release(id);
+    }
+
+    // Function to drop the rows above the first row of every open component
+    // (a component is open exactly when it has runs on the last row)
+    void dropUnusedRows()
+    {
+        int keepFrom = myNextRow;
+        for (const PixelRun &run : myPrevRuns)
+            keepFrom = std::min(keepFrom, myRecords[run.label].minY);
+        while (!myRows.empty() && myFirstRow < keepFrom)
+        {
+            mySpareRows.push_back(std::move(myRows.front()));
+            myRows.pop_front();
+            ++myFirstRow;
+        }
+    }
+
+    int myWidth;
+    int myHeight;
+    size_t myWordsPerRow;
+    int myNextRow = 0;
+
+    std::deque<std::vector<uint64_t>> myRows; // Mask rows myFirstRow, myFirstRow + 1, ...
+    std::vector<std::vector<uint64_t>> mySpareRows;
+    int myFirstRow = 0;
+
+    std::vector<PixelRun> myPrevRuns; // label holds the root id of each run
+    std::vector<PixelRun> myCurrRuns;
+
+    std::vector<uint32_t> myParent;
+    std::vector<GrainRecord> myRecords; // Statistics, valid at roots
+    std::vector<bool> myDone;
+    std::vector<uint32_t> myFreeIds;
+    std::vector<uint32_t> myMerged;
+    std::vector<uint32_t> myCompleted;
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+// Streaming reader of .vol volumes into bit-packed grids.
+//
+// A .vol file is a text header of "Key: value" lines ended by a line with a
+// single dot, followed by one byte per voxel, x first, then y, then z. The
+// voxels are zlib-compressed from version 3 of the format on, raw before.
+//
+// The payload is read by chunks and inflated one row of voxels at a time into
+// a row buffer, which is thresholded straight into the row of a BitVolume, as
+// with packRow() for the PGM masks: a voxel is foreground when its value v
+// satisfies 0 < v <= 255, like SetFromImage::append(set, image, 0, 255). No
+// byte image is ever held, so a 1024^3 volume takes 128 MB instead of 4 GB
+// for an ImageSelector<Z3i::Domain, int> image. The foreground runs may be
+// collected on the way too, as a sparse copy of the volume.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "BitVolume.h"
+#include "MappedPGM.h"
+#include "VolumeLabeling.h"
+
+// A run of foreground voxels [xBegin, xEnd) along x on row (y, z)
+struct VolumeRun
+{
+    int32_t y;
+    int32_t z;
+    int32_t xBegin;
+    int32_t xEnd;
+};
+
+// Header fields of a .vol file used by the reader
+struct VolumeHeader
+{
+    int width = 0;
+    int height = 0;
+    int depth = 0;
+    int version = 0;
+    int voxelSize = 1;
+    size_t dataOffset = 0; // First byte of the voxels
+};
+
+// Function to parse the header of a .vol file from its first bytes; throws
+// std::runtime_error when malformed or when the end of the header is missing
+inline VolumeHeader parseVolumeHeader(const char *data, size_t size, const std::string &fileName)
+{
+    VolumeHeader header;
+    size_t pos = 0;
+    for (;;)
+    {
+        const char *end = static_cast<const char *>(std::memchr(data + pos, '\n', size - pos));
+        if (end == nullptr)
+            throw std::runtime_error(fileName + ": unterminated .vol header");
+        const std::string line(data + pos, end);
+        pos = static_cast<size_t>(end - data) + 1;
+        if (line == ".")
+            break;
+
+        const size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            throw std::runtime_error(fileName + ": malformed .vol header line \"" + line + "\"");
+        const std::string key = line.substr(0, colon);
+        const int value = std::atoi(line.c_str() + colon + 1);
+        if (key == "X")
+            header.width = value;
+        else if (key == "Y")
+            header.height = value;
+        else if (key == "Z")
+            header.depth = value;
+        else if (key == "Version")
+            header.version = value;
+        else if (key == "Voxel-Size")
+            header.voxelSize = value;
+    }
+
+    if (header.width <= 0 || header.height <= 0 || header.depth <= 0)
+        throw std::runtime_error(fileName + ": missing or invalid X, Y, Z in .vol header");
+    if (header.voxelSize != 1)
+        throw std::runtime_error(fileName + ": only 1 byte voxels are supported");
+    header.dataOffset = pos;
+    return header;
+}
+
+// Function to read a .vol file into a bit-packed volume, and into runs when runs is not null
+inline BitVolume readVolumeFile(const std::string &fileName, std::vector<VolumeRun> *runs = nullptr)
+{
+    const int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("cannot open " + fileName);
+
+    // Chunk of the file, large enough for the header
+    std::vector<char> input(1 << 18);
+    size_t inputBegin = 0, inputEnd = 0;
+    auto readChunk = [&]()
+    {
+        ssize_t got;
+        do
+            got = ::read(fd, input.data(), input.size());
+        while (got < 0 && errno == EINTR);
+        inputBegin = 0;
+        inputEnd = got > 0 ? static_cast<size_t>(got) : 0;
+        return inputEnd > 0;
+    };
+
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    bool inflating = false;
+    try
+    {
+        readChunk();
+        const VolumeHeader header = parseVolumeHeader(input.data(), inputEnd, fileName);
+        inputBegin = header.dataOffset;
+
+        const bool compressed = header.version >= 3;
+        if (compressed)
+        {
+            if (inflateInit(&stream) != Z_OK)
+                throw std::runtime_error(fileName + ": cannot initialize zlib");
+            inflating = true;
+        }
+
+        BitVolume volume(header.width, header.height, header.depth);
+        std::vector<unsigned char> row(static_cast<size_t>(header.width));
+        bool streamEnded = false;
+
+        // Function to fill the row buffer with the next voxels; false at the end of the data
+        auto readRow = [&]()
+        {
+            size_t filled = 0;
+            while (filled < row.size())
+            {
+                if (inputBegin == inputEnd && !readChunk())
+                    return false;
+                if (!compressed)
+                {
+                    const size_t bytes = std::min(row.size() - filled, inputEnd - inputBegin);
+                    std::memcpy(row.data() + filled, input.data() + inputBegin, bytes);
+                    filled += bytes;
+                    inputBegin += bytes;
+                    continue;
+                }
+                if (streamEnded)
+                    return false;
+                stream.next_in = reinterpret_cast<Bytef *>(input.data() + inputBegin);
+                stream.avail_in = static_cast<uInt>(inputEnd - inputBegin);
+                stream.next_out = row.data() + filled;
+                stream.avail_out = static_cast<uInt>(row.size() - filled);
+                const int status = inflate(&stream, Z_NO_FLUSH);
+                if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+                    throw std::runtime_error(fileName + ": corrupt compressed voxels (" +
+                                             std::string(stream.msg ? stream.msg : "zlib error") + ")");
+                inputBegin = inputEnd - stream.avail_in;
+                filled = row.size() - stream.avail_out;
+                streamEnded = status == Z_STREAM_END;
+            }
+            return true;
+        };
+
+        for (int z = 0; z < header.depth; ++z)
+        {
+            for (int y = 0; y < header.height; ++y)
+            {
+                if (!readRow())
+                    throw std::runtime_error(fileName + ": truncated voxel data");
+                uint64_t *bits = volume.row(y, z);
+                packRow(row.data(), header.width, 0, 255, bits);
+                if (runs != nullptr)
+                {
+                    forEachVoxelRun(bits, header.width, true, [&](int xBegin, int xEnd)
+                                    { runs->push_back({y, z, xBegin, xEnd}); });
+                }
+            }
+        }
+
+        if (inflating)
+            inflateEnd(&stream);
+        ::close(fd);
+        return volume;
+    }
+    catch (...)
+    {
+        if (inflating)
+            inflateEnd(&stream);
+        ::close(fd);
+        throw;
+    }
+}
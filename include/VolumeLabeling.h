@@ -0,0 +1,301 @@
+#pragma once
+
+// Block-parallel connected component labeling of binary volumes.
+//
+// The volume is read as horizontal runs of voxels along x, one list per row
+// (y, z), either of the foreground (set bits of a BitVolume) or of the
+// background (clear bits inside the volume). A run is joined to the runs of
+// the rows before it that it touches under the chosen adjacency:
+//
+//  - 6:  rows (y - 1, z) and (y, z - 1), overlapping in x;
+//  - 18: the same rows, overlapping or diagonal in x, plus the rows
+//        (y - 1, z - 1) and (y + 1, z - 1), overlapping in x;
+//  - 26: all four rows, overlapping or diagonal in x.
+//
+// The z slices are cut into blocks of consecutive slices. Each block joins
+// its own runs in parallel with the others, then the blocks are joined across
+// their faces, again in parallel. The union-find over run indices is lock-free
+// (compare-and-swap on the parents); as in RunDisjointSets, a root is linked
+// under the smaller one, so the root of a component is its first run in
+// raster order and the labels are deterministic.
+//
+// The background also has the outside of the volume, as if the volume were
+// padded with background: one more node of the union-find, joined to every
+// background run on a face of the volume, and counted even when no
+// background voxel touches the border (the volume is then full, or the object
+// walls it off). This keeps C + (H - 1) - χ right for objects that touch the
+// border, since eulerCharacteristic() pads the volume the same way.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "BitVolume.h"
+#include "WorkStealingPool.h"
+
+// Adjacency of the voxels of a component
+enum VoxelAdjacency
+{
+    ADJACENCY_6 = 6,
+    ADJACENCY_18 = 18,
+    ADJACENCY_26 = 26
+};
+
+// A maximal run of voxels [xBegin, xEnd) along x on one row
+struct VoxelRun
+{
+    int32_t xBegin;
+    int32_t xEnd;
+};
+
+// Runs of a volume and their components
+struct VolumeComponents
+{
+    int width = 0;
+    int height = 0;
+    int depth = 0;
+    std::vector<VoxelRun> runs;     // All runs, in raster order
+    std::vector<size_t> rowOffsets; // Runs of row (y, z) are runs[rowOffsets[r] .. rowOffsets[r + 1]), r = z * height + y
+    std::vector<uint32_t> labels;   // Component of each run, 1..count in raster order
+    uint32_t outsideLabel = 0;      // Component of the outside of the volume, for the background
+    size_t count = 0;
+};
+
+// Union-find over run indices shared by the threads, without locks
+struct ConcurrentDisjointSets
+{
+    std::vector<std::atomic<uint32_t>> parent;
+
+    explicit ConcurrentDisjointSets(size_t count) : parent(count) {}
+
+    uint32_t find(uint32_t i)
+    {
+        for (;;)
+        {
+            uint32_t p = parent[i].load(std::memory_order_relaxed);
+            if (p == i)
+                return i;
+            uint32_t grandParent = parent[p].load(std::memory_order_relaxed);
+            // Path halving; a plain store is enough since parents only ever move
+            // up the tree, and a non-root never becomes a root again
+            if (grandParent != p)
+                parent[i].store(grandParent, std::memory_order_relaxed);
+            i = grandParent;
+        }
+    }
+
+    void unite(uint32_t a, uint32_t b)
+    {
+        for (;;)
+        {
+            a = find(a);
+            b = find(b);
+            if (a == b)
+                return;
+            if (a < b)
+                std::swap(a, b);
+            // Link the larger root under the smaller one, unless a has been linked meanwhile
+            uint32_t expected = a;
+            if (parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+                return;
+        }
+    }
+};
+
+// Function to find the first voxel of the given value at or after x on a row, width if none
+inline int nextVoxel(const uint64_t *row, int width, int x, bool value)
+{
+    if (x >= width)
+        return width;
+    size_t k = static_cast<size_t>(x) >> 6;
+    uint64_t bits = (value ? row[k] : ~row[k]) & (~uint64_t(0) << (x & 63));
+    while (bits == 0)
+    {
+        ++k;
+        if (k * 64 >= static_cast<size_t>(width))
+            return width;
+        bits = value ? row[k] : ~row[k];
+    }
+    return std::min(width, static_cast<int>(k * 64) + __builtin_ctzll(bits));
+}
+
+// Function to call fn(xBegin, xEnd) for every run of voxels of the given value on a row
+template <typename F>
+void forEachVoxelRun(const uint64_t *row, int width, bool value, F &&fn)
+{
+    int x = nextVoxel(row, width, 0, value);
+    while (x < width)
+    {
+        const int end = nextVoxel(row, width, x, !value);
+        fn(x, end);
+        x = nextVoxel(row, width, end, value);
+    }
+}
+
+// Function to unite the runs of two rows that overlap, or that are diagonal
+// in x when reach is 1. Both ranges are sorted by x, so a merge-like sweep suffices.
+inline void uniteTouchingRuns(const std::vector<VoxelRun> &runs,
+                              size_t prevBegin, size_t prevEnd,
+                              size_t currBegin, size_t currEnd,
+                              int reach, ConcurrentDisjointSets &sets)
+{
+    size_t i = prevBegin;
+    size_t j = currBegin;
+    while (i < prevEnd && j < currEnd)
+    {
+        const VoxelRun &a = runs[i];
+        const VoxelRun &b = runs[j];
+        if (a.xBegin < b.xEnd + reach && b.xBegin < a.xEnd + reach)
+            sets.unite(static_cast<uint32_t>(i), static_cast<uint32_t>(j));
+
+        if (a.xEnd < b.xEnd)
+            ++i;
+        else
+            ++j;
+    }
+}
+
+// Function to label the components of the foreground (value true) or of the
+// background (value false) of a volume under the given adjacency
+inline VolumeComponents labelVolume(const BitVolume &volume, bool value, VoxelAdjacency adjacency, WorkStealingPool &pool)
+{
+    VolumeComponents result;
+    result.width = volume.width();
+    result.height = volume.height();
+    result.depth = volume.depth();
+    const int width = volume.width();
+    const int height = volume.height();
+    const int depth = volume.depth();
+    const size_t rows = static_cast<size_t>(height) * static_cast<size_t>(depth);
+
+    // Blocks of consecutive slices, a few per worker for the balance
+    const int blockDepth = std::max(1, depth / static_cast<int>(4 * pool.size()));
+    const size_t blocks = static_cast<size_t>((depth + blockDepth - 1) / blockDepth);
+
+    // STEP 1: count the runs of every row, then write them in place
+    std::vector<size_t> runCounts(rows + 1, 0);
+    pool.parallelFor(blocks, [&](size_t block, unsigned)
+    {
+        const int zEnd = std::min(depth, static_cast<int>(block + 1) * blockDepth);
+        for (int z = static_cast<int>(block) * blockDepth; z < zEnd; ++z)
+        {
+            for (int y = 0; y < height; ++y)
+            {
+                size_t &count = runCounts[static_cast<size_t>(z) * height + y];
+                forEachVoxelRun(volume.row(y, z), width, value, [&](int, int) { ++count; });
+            }
+        }
+    });
+
+    result.rowOffsets.assign(rows + 1, 0);
+    for (size_t r = 0; r < rows; ++r)
+        result.rowOffsets[r + 1] = result.rowOffsets[r] + runCounts[r];
+    result.runs.resize(result.rowOffsets[rows]);
+
+    pool.parallelFor(blocks, [&](size_t block, unsigned)
+    {
+        const int zEnd = std::min(depth, static_cast<int>(block + 1) * blockDepth);
+        for (int z = static_cast<int>(block) * blockDepth; z < zEnd; ++z)
+        {
+            for (int y = 0; y < height; ++y)
+            {
+                size_t next = result.rowOffsets[static_cast<size_t>(z) * height + y];
+                forEachVoxelRun(volume.row(y, z), width, value, [&](int xBegin, int xEnd)
+                                { result.runs[next++] = {xBegin, xEnd}; });
+            }
+        }
+    });
+
+    // One more node after the runs for the outside, with the background
+    const bool withOutside = !value;
+    const uint32_t outside = static_cast<uint32_t>(result.runs.size());
+    ConcurrentDisjointSets sets(result.runs.size() + (withOutside ? 1 : 0));
+    if (withOutside)
+        sets.parent[outside].store(outside, std::memory_order_relaxed);
+    pool.parallelFor(blocks, [&](size_t block, unsigned)
+    {
+        const size_t first = result.rowOffsets[std::min(rows, block * blockDepth * height)];
+        const size_t last = result.rowOffsets[std::min(rows, (block + 1) * blockDepth * height)];
+        for (size_t i = first; i < last; ++i)
+            sets.parent[i].store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+    });
+
+    // Rows before (y, z) to join with it, as (dy, dz, reach); reach -1 skips the row
+    const int faceReach = adjacency == ADJACENCY_6 ? 0 : 1;
+    const int edgeReach = adjacency == ADJACENCY_6 ? -1 : (adjacency == ADJACENCY_18 ? 0 : 1);
+    const int neighbours[4][3] = {{-1, 0, faceReach}, {0, -1, faceReach}, {-1, -1, edgeReach}, {1, -1, edgeReach}};
+
+    // Function to join the runs of row (y, z) with the rows before it in slice
+    // z - 1 and/or in slice z
+    auto joinRow = [&](int y, int z, bool withPreviousSlice, bool withOwnSlice)
+    {
+        const size_t r = static_cast<size_t>(z) * height + y;
+        if (withOutside && withOwnSlice)
+        {
+            // Runs on a face of the volume touch the outside
+            const bool onFace = y == 0 || z == 0 || y == height - 1 || z == depth - 1;
+            for (size_t i = result.rowOffsets[r]; i < result.rowOffsets[r + 1]; ++i)
+            {
+                if (onFace || result.runs[i].xBegin == 0 || result.runs[i].xEnd == width)
+                    sets.unite(static_cast<uint32_t>(i), outside);
+            }
+        }
+        for (const auto &neighbour : neighbours)
+        {
+            const int ny = y + neighbour[0];
+            const int nz = z + neighbour[1];
+            if (neighbour[2] < 0 || ny < 0 || nz < 0 || ny >= height)
+                continue;
+            if ((nz == z && !withOwnSlice) || (nz != z && !withPreviousSlice))
+                continue;
+            const size_t nr = static_cast<size_t>(nz) * height + ny;
+            uniteTouchingRuns(result.runs, result.rowOffsets[nr], result.rowOffsets[nr + 1],
+                              result.rowOffsets[r], result.rowOffsets[r + 1], neighbour[2], sets);
+        }
+    };
+
+    // STEP 2: join the runs inside every block
+    pool.parallelFor(blocks, [&](size_t block, unsigned)
+    {
+        const int zBegin = static_cast<int>(block) * blockDepth;
+        const int zEnd = std::min(depth, zBegin + blockDepth);
+        for (int z = zBegin; z < zEnd; ++z)
+        {
+            for (int y = 0; y < height; ++y)
+                joinRow(y, z, z > zBegin, true);
+        }
+    });
+
+    // STEP 3: join the blocks across their faces
+    pool.parallelFor(blocks, [&](size_t block, unsigned)
+    {
+        const int z = static_cast<int>(block) * blockDepth;
+        if (z == 0)
+            return;
+        for (int y = 0; y < height; ++y)
+            joinRow(y, z, true, false);
+    });
+
+    // STEP 4: number the components in the raster order of their first run
+    result.labels.assign(result.runs.size(), 0);
+    for (size_t i = 0; i < result.runs.size(); ++i)
+    {
+        const uint32_t root = sets.find(static_cast<uint32_t>(i));
+        result.labels[i] = root == i ? static_cast<uint32_t>(++result.count) : result.labels[root];
+    }
+    if (withOutside)
+    {
+        const uint32_t root = sets.find(outside);
+        result.outsideLabel = root == outside ? static_cast<uint32_t>(++result.count) : result.labels[root];
+    }
+    return result;
+}
+
+// Function to count the components of the foreground (value true) or of the
+// background (value false), the outside of the volume included
+inline size_t countVolumeComponents(const BitVolume &volume, bool value, VoxelAdjacency adjacency, WorkStealingPool &pool)
+{
+    return labelVolume(volume, value, adjacency, pool).count;
+}
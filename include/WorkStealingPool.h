@@ -0,0 +1,188 @@
+#pragma once
+
+// Persistent thread pool running index loops with work stealing.
+//
+// parallelFor(count, fn) splits [0, count) into one contiguous range per
+// worker. A worker takes indices from the front of its own range and, once it
+// runs dry, steals the back half of another worker's range. The calling thread
+// takes part as worker 0, and fn(index, worker) may use `worker` to address
+// thread-local buffers. Threads are created once and stay alive (and warm)
+// between calls.
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool
+{
+public:
+    // threads is the total number of workers, including the calling thread
+    explicit WorkStealingPool(unsigned threads = std::thread::hardware_concurrency())
+    {
+        threads = std::max(1u, threads);
+        for (unsigned i = 0; i < threads; ++i)
+            myRanges.emplace_back(new Range);
+        for (unsigned i = 1; i < threads; ++i)
+            myThreads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(myMutex);
+            myStop = true;
+        }
+        myWake.notify_all();
+        for (std::thread &thread : myThreads)
+            thread.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(myRanges.size()); }
+
+    // Function to run fn(index, worker) for every index in [0, count).
+    // Returns once all indices are done; rethrows the first exception thrown by fn.
+    template <typename F>
+    void parallelFor(size_t count, F &&fn)
+    {
+        if (count == 0)
+            return;
+        if (size() == 1 || count == 1)
+        {
+            for (size_t i = 0; i < count; ++i)
+                fn(i, 0u);
+            return;
+        }
+
+        const size_t workers = myRanges.size();
+        for (size_t w = 0; w < workers; ++w)
+        {
+            std::lock_guard<std::mutex> guard(myRanges[w]->lock);
+            myRanges[w]->begin = count * w / workers;
+            myRanges[w]->end = count * (w + 1) / workers;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(myMutex);
+            myTask = [&fn](size_t index, unsigned worker) { fn(index, worker); };
+            myError = nullptr;
+            myBusy = static_cast<unsigned>(myThreads.size());
+            ++myGeneration;
+        }
+        myWake.notify_all();
+
+        runWorker(0);
+
+        std::unique_lock<std::mutex> lock(myMutex);
+        myDone.wait(lock, [this] { return myBusy == 0; });
+        myTask = nullptr;
+        if (myError)
+            std::rethrow_exception(myError);
+    }
+
+private:
+    struct Range
+    {
+        std::mutex lock;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    void workerLoop(unsigned id)
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(myMutex);
+                myWake.wait(lock, [&] { return myStop || myGeneration != seen; });
+                if (myStop)
+                    return;
+                seen = myGeneration;
+            }
+
+            runWorker(id);
+
+            std::lock_guard<std::mutex> guard(myMutex);
+            if (--myBusy == 0)
+                myDone.notify_one();
+        }
+    }
+
+    void runWorker(unsigned id)
+    {
+        size_t index;
+        while (next(id, index))
+        {
+            try
+            {
+                myTask(index, id);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(myMutex);
+                if (!myError)
+                    myError = std::current_exception();
+            }
+        }
+    }
+
+    // Function to take the next index from the own range, or to steal the
+    // back half of another worker's range when the own range is empty
+    bool next(unsigned id, size_t &index)
+    {
+        Range &own = *myRanges[id];
+        {
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (own.begin < own.end)
+            {
+                index = own.begin++;
+                return true;
+            }
+        }
+
+        const size_t workers = myRanges.size();
+        for (size_t k = 1; k < workers; ++k)
+        {
+            Range &victim = *myRanges[(id + k) % workers];
+            size_t stolenBegin, stolenEnd;
+            {
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (victim.begin >= victim.end)
+                    continue;
+                size_t middle = victim.begin + (victim.end - victim.begin) / 2;
+                stolenBegin = middle;
+                stolenEnd = victim.end;
+                victim.end = middle;
+            }
+
+            std::lock_guard<std::mutex> guard(own.lock);
+            index = stolenBegin;
+            own.begin = stolenBegin + 1;
+            own.end = stolenEnd;
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Range>> myRanges;
+    std::vector<std::thread> myThreads;
+
+    std::mutex myMutex;
+    std::condition_variable myWake;
+    std::condition_variable myDone;
+    std::function<void(size_t, unsigned)> myTask;
+    std::exception_ptr myError;
+    uint64_t myGeneration = 0;
+    unsigned myBusy = 0;
+    bool myStop = false;
+};